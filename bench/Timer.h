@@ -0,0 +1,11 @@
+#pragma once
+
+#include <chrono>
+
+typedef std::chrono::steady_clock Clock;
+
+//! the time since start
+inline double Seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+//! Zipf distributed word indices by inverting the cumulative distribution
+class Zipf
+{
+public:
+    Zipf(size_t n, double s) : cdf(n)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            cdf[i] = (sum += 1.0 / pow(i + 1.0, s));
+        for (auto& c : cdf)
+            c /= sum;
+    }
+    template<typename Rng>
+    size_t operator()(Rng& rng)
+    {
+        const double u = std::uniform_real_distribution<double>()(rng);
+        return std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    }
+private:
+    std::vector<double> cdf;
+};
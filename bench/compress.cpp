@@ -0,0 +1,121 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "Lz.h"
+#include "Utils.h"
+#include "RunFormat.h"
+#include "Zipf.h"
+#include "Timer.h"
+
+/* break-even of --compress-temp
+ *
+ * Writes and reads a run of sorted n-grams (the format of the text mode
+ * ecollect runs) raw and compressed in the given directory, and models the
+ * same on disks of a given bandwidth from the measured codec speed.
+ * Point the directory to a tmpfs (/dev/shm) for a fast disk, and to a
+ * throttled device (a loop device with an io.max limit, caches dropped)
+ * for a slow one.
+ */
+
+static double WriteRun(const std::vector<std::string>& keys, const std::string& filename, bool compress)
+{
+    const auto start = Clock::now();
+    FILE* f = fopen(filename.c_str(), "wb");
+    RunWriter writer(f, false, compress);
+    uint64_t count = 1;
+    for (const auto& key : keys)
+        writer.Write(key.data(), key.size(), count++ % 1000);
+    writer.Flush();
+    fclose(f);
+    return Seconds(start);
+}
+
+static double ReadRun(const std::string& filename, size_t& size)
+{
+    const auto start = Clock::now();
+    FILE* f = fopen(filename.c_str(), "rb");
+    {
+        BlockReader reader(f);
+        std::vector<char> block(1 << 16);
+        size = 0;
+        for (size_t n; (n = reader.Read(block.data(), block.size())) > 0;)
+            size += n;
+    }
+    fclose(f);
+    return Seconds(start);
+}
+
+int main(int argc, const char* argv[])
+{
+    const std::string directory = argc > 1 ? argv[1] : ".";
+    const size_t records = argc > 2 ? (size_t)atoll(argv[2]) : 2000000;
+    const size_t n = argc > 3 ? (size_t)atoll(argv[3]) : 2;
+
+    std::default_random_engine rng(0);
+    Zipf zipf(100000, 1.0);
+    std::vector<std::string> keys(records);
+    for (auto& key : keys)
+    {
+        for (size_t j = 0; j < n; ++j)
+            key += (j > 0 ? " w" : "w") + std::to_string(zipf(rng));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    const std::string raw_name = directory + "/bench_raw.tmp", packed_name = directory + "/bench_lz.tmp";
+    const double raw_write = WriteRun(keys, raw_name, false);
+    const double packed_write = WriteRun(keys, packed_name, true);
+    size_t contents;
+    const double raw_read = ReadRun(raw_name, contents);
+    const double packed_read = ReadRun(packed_name, contents);
+    const size_t raw_size = GetFileSize(raw_name), packed_size = GetFileSize(packed_name);
+
+    // the codec alone, on the frames of the raw run
+    std::vector<char> data(raw_size);
+    FILE* f = fopen(raw_name.c_str(), "rb");
+    data.resize(fread(data.data(), 1, data.size(), f));
+    fclose(f);
+    remove(raw_name.c_str());
+    remove(packed_name.c_str());
+    std::vector<char> packed(LzBound(lz_frame_size)), back(lz_frame_size);
+    std::vector<std::pair<size_t, std::vector<char>>> frames;
+    auto start = Clock::now();
+    for (size_t i = 0; i < data.size(); i += lz_frame_size)
+    {
+        const size_t size = std::min(lz_frame_size, data.size() - i);
+        const size_t m = LzCompress(data.data() + i, size, packed.data(), packed.size());
+        frames.emplace_back(size, std::vector<char>(packed.begin(), packed.begin() + m));
+    }
+    const double compress_time = Seconds(start);
+    start = Clock::now();
+    bool correct = true;
+    for (const auto& frame : frames)
+        correct = LzDecompress(frame.second.data(), frame.second.size(), back.data(), frame.first) && correct;
+    const double decompress_time = Seconds(start);
+
+    printf("%zu %zu-grams, run %.1f MB, compressed %.1f MB (%.1f%%)%s\n", records, n,
+        raw_size / 1e6, packed_size / 1e6, 100.0 * packed_size / raw_size, correct && contents == raw_size ? "" : " WRONG");
+    printf("codec: compress %.0f MB/s, decompress %.0f MB/s\n",
+        raw_size / compress_time / 1e6, raw_size / decompress_time / 1e6);
+    printf("measured in %s:\n", directory.c_str());
+    printf("  %-10s write %7.3f s, read %7.3f s\n", "raw", raw_write, raw_read);
+    printf("  %-10s write %7.3f s, read %7.3f s\n", "compressed", packed_write, packed_read);
+
+    // compression pays off, if the bytes saved take longer on the disk than the codec
+    const double saved = (double)raw_size - packed_size;
+    printf("break-even disk bandwidth: write %.0f MB/s, read %.0f MB/s\n",
+        saved / compress_time / 1e6, saved / decompress_time / 1e6);
+    printf("modeled write + read:\n");
+    for (double bandwidth : { 100.0, 500.0, 2000.0, 10000.0 })
+    {
+        const double raw_time = 2 * raw_size / (bandwidth * 1e6);
+        const double packed_time = 2 * packed_size / (bandwidth * 1e6) + compress_time + decompress_time;
+        printf("  %6.0f MB/s %8.3f s raw %8.3f s compressed %6.2fx\n",
+            bandwidth, raw_time, packed_time, raw_time / packed_time);
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "DataTypes.h"
+#include "Hash.h"
+#include "Zipf.h"
+
+template<typename Table>
+static void Measure(const char* name, const std::vector<DataView<false>>& keys, double rehash_constant)
+{
+    Table table(8, rehash_constant, 2.0);
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& key : keys)
+    {
+        table.insert(key);
+        if (table.GetSize() > rehash_constant * table.GetAllocatedSize())
+            table.rehash();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const auto& stats = table.GetStats();
+    printf("%-8s %8.2f M inserts/s %8.3f probes/insert %8.3f compares/insert %10zu distinct\n",
+        name, keys.size() / seconds / 1e6,
+        stats.probes / double(stats.lookups), stats.compares / double(stats.lookups),
+        table.GetSize());
+}
+
+int main(int argc, const char* argv[])
+{
+    const size_t tokens = argc > 1 ? (size_t)atoll(argv[1]) : 5000000;
+    const size_t n = argc > 2 ? (size_t)atoll(argv[2]) : 3;
+    const size_t vocabulary = argc > 3 ? (size_t)atoll(argv[3]) : 100000;
+    const double exponent = argc > 4 ? atof(argv[4]) : 1.0;
+
+    SetSeparator("\n");
+
+    // n-grams of a Zipf distributed word sequence, one per line
+    std::default_random_engine rng(0);
+    Zipf zipf(vocabulary, exponent);
+    std::vector<size_t> words(tokens + n);
+    for (auto& w : words)
+        w = zipf(rng);
+    std::string text;
+    for (size_t i = 0; i < tokens; ++i)
+    {
+        for (size_t j = 0; j < n; ++j)
+        {
+            if (j > 0)
+                text += ' ';
+            text += 'w' + std::to_string(words[i + j]);
+        }
+        text += '\n';
+    }
+
+    std::vector<char> buffer(text.begin(), text.end());
+    std::vector<DataView<false>> keys;
+    keys.reserve(tokens);
+    char* state = buffer.data();
+    DataView<false> key;
+    while (key.ReadFrom(state, buffer.data() + buffer.size()))
+        keys.push_back(key);
+
+    printf("%zu %zu-grams, vocabulary %zu, exponent %g\n", keys.size(), n, vocabulary, exponent);
+    for (double rehash_constant : { 0.5, 0.75, 0.875 })
+    {
+        printf("rehash factor %g\n", rehash_constant);
+        Measure<HashTable<false>>("linear", keys, rehash_constant);
+        Measure<GroupHashTable<false>>("group", keys, rehash_constant);
+    }
+    return 0;
+}
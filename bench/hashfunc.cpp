@@ -0,0 +1,55 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+
+#include "Utils.h"
+
+template<typename Hash>
+static void Measure(const char* name, const std::vector<std::string>& keys, int repeat)
+{
+    size_t checksum = 0, bytes = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeat; ++r)
+        for (const auto& key : keys)
+        {
+            checksum += Hash::hash(key.c_str(), key.size() + 1);
+            bytes += key.size() + 1;
+        }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-8s %8.2f M keys/s %8.3f GB/s (checksum %zx)\n", name,
+        repeat * keys.size() / seconds / 1e6, bytes / seconds / 1e9, checksum);
+}
+
+int main(int argc, const char* argv[])
+{
+    const size_t n = argc > 1 ? (size_t)atoll(argv[1]) : 1000000;
+    const int repeat = 10;
+
+    std::default_random_engine rng(0);
+    std::uniform_int_distribution<size_t> word_length(2, 9);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    // keys are hashed with their terminating '\0', just like in ecollect
+    for (size_t words = 1; words <= 3; ++words)
+    {
+        std::vector<std::string> keys(n);
+        size_t total = 0;
+        for (auto& key : keys)
+        {
+            for (size_t w = 0; w < words; ++w)
+            {
+                if (w > 0)
+                    key += ' ';
+                for (size_t l = word_length(rng); l > 0; --l)
+                    key += (char)letter(rng);
+            }
+            total += key.size() + 1;
+        }
+        printf("%zu-word keys, average length %.1f bytes\n", words, double(total) / n);
+        Measure<Fnv1a>("fnv1a", keys, repeat);
+        Measure<WyHash>("wyhash", keys, repeat);
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "DataTypes.h"
+#include "Hash.h"
+#include "SpaceSaving.h"
+#include "Zipf.h"
+#include "Timer.h"
+
+int main(int argc, const char* argv[])
+{
+    const size_t tokens = argc > 1 ? (size_t)atoll(argv[1]) : 5000000;
+    const size_t n = argc > 2 ? (size_t)atoll(argv[2]) : 2;
+    const size_t vocabulary = argc > 3 ? (size_t)atoll(argv[3]) : 100000;
+    const double exponent = argc > 4 ? atof(argv[4]) : 1.0;
+    // report the keys with at least this frequency
+    const size_t cutoff = argc > 5 ? (size_t)atoll(argv[5]) : tokens / 10000;
+
+    SetSeparator("\n");
+
+    // n-grams of a Zipf distributed word sequence, one per line
+    std::default_random_engine rng(0);
+    Zipf zipf(vocabulary, exponent);
+    std::vector<size_t> words(tokens + n);
+    for (auto& w : words)
+        w = zipf(rng);
+    std::string text;
+    for (size_t i = 0; i < tokens; ++i)
+    {
+        for (size_t j = 0; j < n; ++j)
+        {
+            if (j > 0)
+                text += ' ';
+            text += 'w' + std::to_string(words[i + j]);
+        }
+        text += '\n';
+    }
+
+    std::vector<char> buffer(text.begin(), text.end());
+    std::vector<DataView<false>> keys;
+    keys.reserve(tokens);
+    char* state = buffer.data();
+    DataView<false> key;
+    while (key.ReadFrom(state, buffer.data() + buffer.size()))
+        keys.push_back(key);
+
+    // the exact path, an in-memory hash table without spilling
+    auto start = Clock::now();
+    GroupHashTable<false> table(8, 0.75, 2.0);
+    for (const auto& k : keys)
+    {
+        table.insert(k);
+        if (table.GetSize() > 0.75 * table.GetAllocatedSize())
+            table.rehash();
+    }
+    const double exact_time = Seconds(start);
+    std::vector<RecordView<false>> exact;
+    for (size_t i = 0; i < table.GetAllocatedSize(); ++i)
+    {
+        const auto& rec = table.GetTable()[i];
+        if (rec.ptr && rec.count >= cutoff)
+            exact.push_back(rec);
+    }
+    std::sort(exact.begin(), exact.end());
+
+    printf("%zu %zu-grams, vocabulary %zu, exponent %g, %zu distinct, %zu with count >= %zu\n",
+        keys.size(), n, vocabulary, exponent, table.GetSize(), exact.size(), cutoff);
+    printf("%-10s %8.2f M keys/s\n", "exact", keys.size() / exact_time / 1e6);
+
+    for (size_t capacity : { exact.size(), 2 * exact.size(), 10 * exact.size(), 100 * exact.size() })
+    {
+        start = Clock::now();
+        SpaceSaving<false> counters(capacity);
+        for (const auto& k : keys)
+            counters.insert(k);
+        const double time = Seconds(start);
+
+        std::vector<RecordView<false>> counts, errors;
+        counters.GetRecords(cutoff, counts, errors);
+        // both are sorted lexicographically
+        size_t found = 0, max_error = 0;
+        auto it = counts.begin();
+        for (const auto& rec : exact)
+        {
+            it = std::lower_bound(it, counts.end(), rec);
+            if (it != counts.end() && *it == rec)
+            {
+                ++found;
+                max_error = std::max(max_error, it->count - rec.count);
+            }
+        }
+        printf("%-10zu %8.2f M keys/s %8.2f%% recall %8.2f%% precision %8zu max error %10zu bytes\n",
+            capacity, keys.size() / time / 1e6,
+            100.0 * found / std::max<size_t>(1, exact.size()),
+            100.0 * found / std::max<size_t>(1, counts.size()),
+            max_error, counters.GetMemory());
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <chrono>
+
+#include "InputFiles.h"
+#include "Tokenizer.h"
+#include "Utils.h"
+#include "Timer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+/* read throughput of the input files with more reader threads
+ *
+ * Reads the given file (or a generated one of the given size, in the
+ * current directory) through ReadInput, like eprocess does, with 1, 2, 4, 8
+ * and 16 readers, and with a single fread from stdio.
+ * With "cold" the file is dropped from the page cache before every run
+ * (posix_fadvise), so the device is measured (an NVMe drive scales with
+ * the number of requests in flight), otherwise the memory copies are.
+ */
+
+static void DropCache(const std::string& filename)
+{
+#if defined(__unix__) && defined(POSIX_FADV_DONTNEED)
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#else
+    (void)filename;
+#endif
+}
+
+//! reads the input in the blocks of eprocess, returns the bytes and their checksum
+static size_t Consume(size_t (*read)(char*, size_t), uint64_t& checksum)
+{
+    static std::vector<char> buffer(1 << 25);
+    size_t total = 0;
+    checksum = 0;
+    for (size_t n; (n = read(buffer.data(), buffer.size())) > 0;)
+    {
+        for (size_t i = 0; i < n; i += 4096)
+            checksum = checksum * 31 + (unsigned char)buffer[i];
+        total += n;
+    }
+    return total;
+}
+
+static FILE* plain = nullptr;
+
+static size_t ReadPlain(char* out, size_t size)
+{
+    return fread(out, 1, size, plain);
+}
+
+int main(int argc, const char* argv[])
+{
+    std::string filename = argc > 1 ? argv[1] : "";
+    const bool cold = argc > 2 && std::string(argv[2]) == "cold";
+    const bool generated = filename.empty() || GetFileSize(filename) == 0;
+    if (generated)
+    {   // lines of about 60 bytes
+        const size_t size = (size_t)(filename.empty() ? 1 << 30 : atoll(filename.c_str()));
+        filename = "bench_input.tmp";
+        FILE* f = fopen(filename.c_str(), "wb");
+        if (f == NULL)
+            return 1;
+        std::string line;
+        for (size_t written = 0, i = 0; written < size; written += line.size(), ++i)
+        {
+            line = "w" + std::to_string(i * 2654435761u % 1000003) + " w" + std::to_string(i % 997) +
+                " the quick brown fox jumps over the lazy dog\n";
+            fwrite(line.data(), line.size(), 1, f);
+        }
+        fclose(f);
+    }
+    Tokenizer::SetSeparators("\n");
+    const size_t size = GetFileSize(filename);
+    printf("%s, %.1f MB, %s cache\n", filename.c_str(), size / 1e6, cold ? "cold" : "warm");
+
+    uint64_t expected;
+    if (cold)
+        DropCache(filename);
+    plain = fopen(filename.c_str(), "rb");
+    auto start = Clock::now();
+    Consume(ReadPlain, expected);
+    double seconds = Seconds(start);
+    fclose(plain);
+    printf("  %-10s %8.3f s %8.0f MB/s\n", "fread", seconds, size / seconds / 1e6);
+
+    for (size_t readers : { 1, 2, 4, 8, 16 })
+    {
+        if (cold)
+            DropCache(filename);
+        start = Clock::now();
+        SetInput({ filename }, readers, 0);
+        uint64_t checksum;
+        const size_t total = Consume(ReadInput, checksum);
+        seconds = Seconds(start);
+        SetInput({}, 0, 0);
+        printf("  %2zu readers %8.3f s %8.0f MB/s%s\n", readers, seconds, size / seconds / 1e6,
+            total == size && checksum == expected ? "" : " WRONG");
+    }
+    if (generated)
+        remove(filename.c_str());
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+#include "Algorithms.h"
+#include "Timer.h"
+
+//! a sorted run in memory, with the interface of FileReader
+struct RunInMemory
+{
+    std::vector<std::string>::const_iterator it, end;
+    bool next(std::string& t)
+    {
+        if (it == end)
+            return false;
+        t = *it++;
+        return true;
+    }
+};
+
+//! counts the comparisons
+struct Counting
+{
+    size_t* compares;
+    bool operator()(const std::string& one, const std::string& other)const
+    {
+        ++*compares;
+        return one < other;
+    }
+};
+
+//! the binary heap merge, which MergeSort used before the loser tree
+template<typename T, typename Comp, typename Reader>
+class HeapMerge
+{
+    typedef std::pair<T*, Reader*> Pair;
+public:
+    HeapMerge(Reader* begin, Reader* end, Comp comparer)
+        : comp(comparer)
+    {
+        for (; begin < end; ++begin)
+        {
+            queue.emplace_back(new T(), begin);
+            auto& p = queue.back();
+            if (p.second->next(*p.first))
+                std::push_heap(queue.begin(), queue.end(), comp);
+            else
+            {
+                delete p.first;
+                queue.pop_back();
+            }
+        }
+    }
+    bool next(T& t)
+    {
+        if (queue.empty())
+            return false;
+        std::pop_heap(queue.begin(), queue.end(), comp);
+        Pair& top = queue.back();
+        t = std::move(*top.first);
+        if (top.second->next(*top.first))
+            std::push_heap(queue.begin(), queue.end(), comp);
+        else
+        {
+            delete top.first;
+            queue.pop_back();
+        }
+        return true;
+    }
+private:
+    struct grt
+    {
+        grt(Comp comparer) : comp(comparer) {}
+        bool operator()(const Pair& one, const Pair& other)const
+        {
+            return comp(*other.first, *one.first);
+        }
+        const Comp comp;
+    } comp;
+    std::vector<Pair> queue;
+};
+
+template<template<typename, typename, typename> class Merge>
+static void Measure(const char* name, const std::vector<std::vector<std::string>>& runs, size_t total)
+{
+    std::vector<RunInMemory> readers;
+    for (const auto& run : runs)
+        readers.push_back({ run.begin(), run.end() });
+    size_t checksum = 0, n = 0;
+    const auto start = Clock::now();
+    {
+        Merge<std::string, std::less<std::string>, RunInMemory> merge(readers.data(), readers.data() + readers.size(), std::less<std::string>());
+        std::string t;
+        while (merge.next(t))
+        {
+            checksum += t.size();
+            ++n;
+        }
+    }
+    const double seconds = Seconds(start);
+
+    // the comparisons are counted in a separate, untimed pass
+    size_t compares = 0;
+    readers.clear();
+    for (const auto& run : runs)
+        readers.push_back({ run.begin(), run.end() });
+    Merge<std::string, Counting, RunInMemory> merge(readers.data(), readers.data() + readers.size(), Counting{ &compares });
+    std::string t;
+    while (merge.next(t))
+        ;
+    printf("  %-6s %8.2f M records/s %8.3f compares/record%s\n",
+        name, n / seconds / 1e6, compares / double(n), n == total ? "" : " WRONG COUNT");
+    (void)checksum;
+}
+
+int main(int argc, const char* argv[])
+{
+    const size_t total = argc > 1 ? (size_t)atoll(argv[1]) : 2000000;
+    const size_t length = argc > 2 ? (size_t)atoll(argv[2]) : 12;
+
+    std::default_random_engine rng(0);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    for (size_t k = 8; k <= 1024; k *= 2)
+    {
+        std::vector<std::vector<std::string>> runs(k);
+        for (size_t i = 0; i < total; ++i)
+        {
+            std::string key(length, ' ');
+            for (auto& c : key)
+                c = (char)letter(rng);
+            runs[i % k].push_back(std::move(key));
+        }
+        for (auto& run : runs)
+            std::sort(run.begin(), run.end());
+
+        printf("k = %zu\n", k);
+        Measure<HeapMerge>("heap", runs, total);
+        Measure<MergeSort>("loser", runs, total);
+    }
+    return 0;
+}
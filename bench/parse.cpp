@@ -0,0 +1,105 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+
+#include "Tuple.h"
+#include "Timer.h"
+
+/* the compiled text format of esort against sscanf
+ *
+ * Parses generated lines of a few typical formats with ParseText and with
+ * sscanf of the patched format (what esort did before), checks that both
+ * give the same fields and prints the lines per second of both.
+ * The argument is the number of lines, 1M by default.
+ */
+
+static std::string Field(char type, std::mt19937_64& rng)
+{
+    char buffer[64];
+    switch (type)
+    {
+    case 'd':
+        snprintf(buffer, sizeof(buffer), "%d", (int)(rng() % 2000001) - 1000000);
+        break;
+    case 'f':
+        snprintf(buffer, sizeof(buffer), "%.6f", (double)(rng() % 100000000) / 1000 - 50000);
+        break;
+    case 'g':
+        snprintf(buffer, sizeof(buffer), "%.17g", (double)rng() / 3.0e15);
+        break;
+    default:
+    {
+        static const char* words[] = { "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog" };
+        snprintf(buffer, sizeof(buffer), "%s%u", words[rng() % 8], (unsigned)(rng() % 1000));
+        break;
+    }
+    }
+    return buffer;
+}
+
+int main(int argc, const char* argv[])
+{
+    const size_t n = argc > 1 ? (size_t)atoll(argv[1]) : 1000000;
+    // the format, and the field kinds of the generated lines
+    const std::pair<const char*, const char*> formats[] = {
+        { "%s\t%d\t%lf", "sdf" },
+        { "%d\t%d\t%d", "ddd" },
+        { "%s %s %s", "sss" },
+        { "%d %lf %lf %d", "dfgd" },
+        { "%*s %d %[^\n]", "sds" },
+    };
+    std::mt19937_64 rng(1);
+    for (const auto& format : formats)
+    {
+        std::vector<std::string> lines(n);
+        for (auto& line : lines)
+        {
+            for (const char* kind = format.second; *kind; ++kind)
+                line += (kind == format.second ? "" : strchr(format.first, '\t') ? "\t" : " ") + Field(*kind, rng);
+        }
+        if (!TupleView<false>::InitParse(format.first, {}))
+            return 1;
+        const auto& offsets = TupleView<false>::offsets;
+        if (offsets.size() > 8)
+            return 1;
+        std::vector<char> parsed(TupleView<false>::parsed_size), expected(parsed.size());
+
+        auto start = Clock::now();
+        size_t accepted = 0;
+        for (const auto& line : lines)
+            accepted += ParseText(line.c_str(), parsed.data());
+        const double compiled = Seconds(start);
+
+        // sscanf takes the fields as varargs, the unused ones point to a dummy
+        char* fields[8];
+        char dummy[16];
+        for (size_t k = 0; k < 8; ++k)
+            fields[k] = k < offsets.size() ? expected.data() + offsets[k] : dummy;
+        start = Clock::now();
+        size_t expected_accepted = 0;
+        for (const auto& line : lines)
+            expected_accepted += sscanf(line.c_str(), TupleView<false>::patched_format.c_str(), fields[0], fields[1],
+                fields[2], fields[3], fields[4], fields[5], fields[6], fields[7]) == TupleView<false>::non_str_field_number;
+        const double scanned = Seconds(start);
+
+        size_t wrong = accepted != expected_accepted;
+        for (size_t i = 0; i < n && i < 10000; ++i)
+        {
+            const char* line = lines[i].c_str();
+            ParseText(line, parsed.data());
+            sscanf(line, TupleView<false>::patched_format.c_str(), fields[0], fields[1], fields[2], fields[3],
+                fields[4], fields[5], fields[6], fields[7]);
+            wrong += memcmp(parsed.data(), expected.data(), parsed.size()) != 0;
+        }
+        std::string name;
+        for (const char* c = format.first; *c; ++c)
+            name += *c == '\t' ? "\\t" : *c == '\n' ? "\\n" : std::string(1, *c);
+        printf("%-20s compiled %8.1f Mlines/s   sscanf %8.1f Mlines/s   %5.1fx%s\n", name.c_str(), n / compiled / 1e6,
+            n / scanned / 1e6, scanned / compiled, wrong ? " WRONG" : "");
+    }
+    return 0;
+}
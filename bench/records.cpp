@@ -0,0 +1,140 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <new>
+
+#include "Tuple.h"
+#include "StringSort.h"
+#include "Timer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#   include <sys/resource.h>
+#endif
+
+/* the memory of an esort run in text mode
+ *
+ * Reads a buffer of generated lines and sorts them, once with a
+ * TupleView<false> (and its parsed vector) per line, like esort did, and
+ * once with TupleBatch (twice, the second run reuses its buffers, like the
+ * runs of esort do). Prints the heap allocations per line and the peak of
+ * the heap used for the lines (the buffer itself not included) relative to
+ * the buffer size, counted by operator new.
+ * The arguments are the buffer size (64 MB by default) and the format and
+ * the keys, "%s\t%d\t%lf" and "2 -3" by default.
+ */
+
+static size_t allocations = 0, live = 0, peak = 0;
+
+// the size is kept before the block
+void* operator new(size_t size)
+{
+    void* p = malloc(size + 16);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    *(size_t*)p = size;
+    ++allocations;
+    live += size;
+    peak = std::max(peak, live);
+    return (char*)p + 16;
+}
+
+// g++ takes the free of a block from this operator new for a mismatch
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#   pragma GCC diagnostic push
+#   pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept
+{
+    if (p)
+    {
+        live -= *(size_t*)((char*)p - 16);
+        free((char*)p - 16);
+    }
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#   pragma GCC diagnostic pop
+#endif
+
+static void Reset()
+{
+    allocations = 0;
+    peak = live;
+}
+
+int main(int argc, const char* argv[])
+{
+    const size_t buffer_size = argc > 1 ? (size_t)atoll(argv[1]) : 1 << 26;
+    const char* format = argc > 2 ? argv[2] : "%s\t%d\t%lf";
+    std::vector<int> keys;
+    {
+        const char* k = argc > 3 ? argv[3] : "2 -3";
+        for (char* end; (keys.push_back((int)strtol(k, &end, 10)), end != k); k = end)
+            ;
+        keys.pop_back();
+    }
+    SetSeparator("\n");
+    if (!TupleView<false>::InitParse(format, keys))
+        return 1;
+
+    std::mt19937_64 rng(1);
+    std::string input;
+    while (input.size() < buffer_size)
+    {
+        char line[128];
+        snprintf(line, sizeof(line), "w%u\t%d\t%.6f\n", (unsigned)(rng() % 100000), (int)(rng() % 2001) - 1000,
+            (double)(rng() % 100000000) / 1000);
+        input += line;
+    }
+    input.resize(input.rfind('\n', buffer_size - 1) + 1);
+    size_t lines = 0;
+    for (char c : input)
+        lines += c == '\n';
+    printf("%zu lines in %.1f MB, \"%s\"\n", lines, input.size() / 1e6, argc > 2 ? argv[2] : "%s\\t%d\\t%lf");
+
+    {
+        std::vector<char> buffer(input.begin(), input.end());
+        Reset();
+        const size_t before = live;
+        const auto start = Clock::now();
+        std::vector<TupleView<false>> table;
+        TupleView<false> t;
+        char* p = buffer.data();
+        while (t.ReadFrom(p, buffer.data() + buffer.size()))
+            table.emplace_back(t);
+        StringSort(table.data(), table.data() + table.size(), [](const TupleView<false>& v)
+        {
+            return std::make_pair(v.key(), v.key_size());
+        });
+        const double seconds = Seconds(start);
+        printf("  TupleView  %6.3f s %8.2f allocations/line  peak heap %5.2f x buffer\n", seconds,
+            (double)allocations / table.size(), (double)(peak - before) / input.size());
+    }
+    {
+        std::vector<char> buffer(input.begin(), input.end());
+        const size_t before = live;
+        TupleBatch batch;
+        for (size_t run = 0; run < 2; ++run)
+        {
+            std::copy(input.begin(), input.end(), buffer.begin());
+            batch.Clear();
+            Reset();
+            const auto start = Clock::now();
+            char* p = buffer.data();
+            batch.Read(p, buffer.data() + buffer.size());
+            const auto sorted = batch.Sort();
+            const double seconds = Seconds(start);
+            printf("  TupleBatch %6.3f s %8.2f allocations/line  peak heap %5.2f x buffer  (run %zu)\n", seconds,
+                (double)allocations / (sorted.second - sorted.first), (double)(peak - before) / input.size(), run + 1);
+        }
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        printf("  peak RSS of the process %.2f x buffer\n", usage.ru_maxrss * 1024.0 / input.size());
+#endif
+    return 0;
+}
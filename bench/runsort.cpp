@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <thread>
+
+#include "Tuple.h"
+#include "Timer.h"
+
+/* the run sort of esort on 1 to 32 threads
+ *
+ * Sorts a buffer of generated lines with TupleBatch (text mode), and a
+ * buffer of 16 byte records by their first 8 bytes, as unsigned, with
+ * SortRun (binary mode), on 1, 2, 4, 8, 16 and 32 threads. Prints the time
+ * of the sort, the speedup over 1 thread, and whether the order differs
+ * from the one of 1 thread (it should not).
+ * The arguments are the buffer size (64 MB by default) and the format and
+ * the keys of the lines, "%s\t%d\t%lf" and "2 -3" by default.
+ */
+
+static const size_t thread_counts[] = { 1, 2, 4, 8, 16, 32 };
+
+int main(int argc, const char* argv[])
+{
+    const size_t buffer_size = argc > 1 ? (size_t)atoll(argv[1]) : 1 << 26;
+    const char* format = argc > 2 ? argv[2] : "%s\t%d\t%lf";
+    std::vector<int> keys;
+    {
+        const char* k = argc > 3 ? argv[3] : "2 -3";
+        for (char* end; (keys.push_back((int)strtol(k, &end, 10)), end != k); k = end)
+            ;
+        keys.pop_back();
+    }
+    printf("%u hardware threads\n", std::thread::hardware_concurrency());
+
+    SetSeparator("\n");
+    if (!TupleView<false>::InitParse(format, keys))
+        return 1;
+    std::mt19937_64 rng(1);
+    std::string input;
+    while (input.size() < buffer_size)
+    {
+        char line[128];
+        snprintf(line, sizeof(line), "w%u\t%d\t%.6f\n", (unsigned)(rng() % 100000), (int)(rng() % 2001) - 1000,
+            (double)(rng() % 100000000) / 1000);
+        input += line;
+    }
+    input.resize(input.rfind('\n', buffer_size - 1) + 1);
+    printf("text: %.1f MB, \"%s\"\n", input.size() / 1e6, argc > 2 ? argv[2] : "%s\\t%d\\t%lf");
+    {
+        std::vector<char> buffer(input.begin(), input.end());
+        std::vector<const char*> first;
+        double one = 0;
+        TupleBatch batch;
+        for (const size_t threads : thread_counts)
+        {
+            std::copy(input.begin(), input.end(), buffer.begin());
+            batch.Clear();
+            char* p = buffer.data();
+            batch.Read(p, buffer.data() + buffer.size());
+            const auto start = Clock::now();
+            const auto sorted = batch.Sort(threads);
+            const double seconds = Seconds(start);
+            std::vector<const char*> order;
+            for (auto line = sorted.first; line < sorted.second; ++line)
+                order.push_back(line->ptr);
+            if (threads == 1)
+            {
+                first = order;
+                one = seconds;
+            }
+            printf("  %2zu threads %7.3f s %6.2fx%s\n", threads, seconds, one / seconds, order != first ? " DIFFERENT" : "");
+        }
+    }
+
+    // a few thousand distinct keys, so there are a lot of ties
+    const size_t record_size = 16;
+    SetBinary(record_size);
+    if (!TupleView<true>::InitParse("%lu%lu", std::vector<int>(1, 1)))
+        return 1;
+    std::vector<char> records(buffer_size / record_size * record_size);
+    for (size_t i = 0; i < records.size(); i += record_size)
+    {
+        const uint64_t key = rng() % 5000, id = i / record_size;
+        memcpy(records.data() + i, &key, 8);
+        memcpy(records.data() + i + 8, &id, 8);
+    }
+    printf("binary: %zu records of %zu bytes\n", records.size() / record_size, record_size);
+    {
+        std::vector<const char*> first;
+        double one = 0;
+        for (const size_t threads : thread_counts)
+        {
+            std::vector<TupleView<true>> table(records.size() / record_size);
+            for (size_t i = 0; i < table.size(); ++i)
+                table[i].ptr = records.data() + i * record_size;
+            const auto start = Clock::now();
+            SortRun(table.data(), table.data() + table.size(), threads);
+            const double seconds = Seconds(start);
+            std::vector<const char*> order;
+            for (const auto& record : table)
+                order.push_back(record.ptr);
+            if (threads == 1)
+            {
+                first = order;
+                one = seconds;
+            }
+            printf("  %2zu threads %7.3f s %6.2fx%s\n", threads, seconds, one / seconds, order != first ? " DIFFERENT" : "");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "StringSort.h"
+#include "Zipf.h"
+#include "Timer.h"
+
+/* the radix sort of StringSort.h against std::sort and std::stable_sort
+ *
+ * Sorts records pointing to keys in one buffer, like the records of esort
+ * and ecollect do, on random words, random fixed size binary keys (like the
+ * normalized numeric keys of esort), already sorted and reversed words,
+ * words with a long common prefix and Zipf distributed words (a lot of
+ * duplicates). The argument is the number of records, 1M by default.
+ */
+
+struct Record
+{
+    const char* ptr;
+    size_t size;
+    size_t id;
+};
+
+struct Key
+{
+    std::pair<const char*, size_t> operator()(const Record& r)const
+    {
+        return std::make_pair(r.ptr, r.size);
+    }
+};
+
+static bool Less(const Record& a, const Record& b)
+{
+    const int c = memcmp(a.ptr, b.ptr, std::min(a.size, b.size));
+    return c < 0 || (c == 0 && a.size < b.size);
+}
+
+static std::string Word(size_t i)
+{
+    static const char* syllables[] = { "ka", "lo", "mi", "ne", "ru", "sa", "to", "vi", "xe", "zu", "qua", "ph" };
+    std::string word;
+    for (i = i * 2654435761u % 1000000007u; word.empty() || i > 0; i /= 12)
+        word += syllables[i % 12];
+    return word;
+}
+
+int main(int argc, const char* argv[])
+{
+    const size_t n = argc > 1 ? (size_t)atoll(argv[1]) : 1000000;
+    std::mt19937_64 rng(1);
+    const char* names[] = { "random words", "random 12 bytes", "sorted words", "reversed words",
+        "common prefix", "zipf words" };
+    for (size_t kind = 0; kind < sizeof(names) / sizeof(*names); ++kind)
+    {
+        std::vector<std::string> keys(n);
+        Zipf zipf(100000, 1.1);
+        for (size_t i = 0; i < n; ++i)
+        {
+            switch (kind)
+            {
+            case 0: keys[i] = Word(rng()); break;
+            case 1: keys[i].resize(12); for (auto& c : keys[i]) c = (char)rng(); break;
+            case 2:
+            case 3: keys[i] = Word(rng()); break;
+            case 4: keys[i] = "http://www.example.com/index/" + Word(rng() % 1000) + "/" + Word(rng()); break;
+            default: keys[i] = Word(zipf(rng)); break;
+            }
+        }
+        if (kind == 2 || kind == 3)
+        {
+            std::sort(keys.begin(), keys.end());
+            if (kind == 3)
+                std::reverse(keys.begin(), keys.end());
+        }
+        std::string buffer;
+        std::vector<size_t> offsets;
+        for (const auto& key : keys)
+        {
+            offsets.push_back(buffer.size());
+            buffer += key;
+        }
+        std::vector<Record> records(n);
+        for (size_t i = 0; i < n; ++i)
+            records[i] = Record{ buffer.data() + offsets[i], keys[i].size(), i };
+
+        auto sorted = records;
+        auto start = Clock::now();
+        std::sort(sorted.begin(), sorted.end(), Less);
+        const double comparison = Seconds(start);
+
+        auto stable = records;
+        start = Clock::now();
+        std::stable_sort(stable.begin(), stable.end(), Less);
+        const double stable_comparison = Seconds(start);
+
+        auto radix = records;
+        start = Clock::now();
+        StringSort(radix.data(), radix.data() + radix.size(), Key());
+        const double seconds = Seconds(start);
+
+        bool wrong = false;
+        for (size_t i = 0; i < n; ++i)
+            wrong |= radix[i].id != stable[i].id;
+        printf("%-16s std::sort %7.3f s   std::stable_sort %7.3f s   StringSort %7.3f s   %5.1fx%s\n", names[kind],
+            comparison, stable_comparison, seconds, comparison / seconds, wrong ? " WRONG" : "");
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+
+#include "DataTypes.h"
+#include "Tokenizer.h"
+
+// the tokenizer loop before the byte-class table was introduced
+static bool ReadFromStrchr(DataView<false>& view, char*& buffer, char* end)
+{
+    const char* separators = DataView<false>::separators;
+    while (buffer < end && strchr(separators, *buffer) != NULL)
+        *buffer++ = '\0';
+    view.ptr = buffer;
+    while (buffer < end && strchr(separators, *buffer) == NULL)
+        ++buffer;
+    if (buffer == end)
+    {
+        buffer = (char*)view.ptr;
+        view.ptr = nullptr;
+        return false;
+    }
+    *buffer++ = '\0';
+    view.size = buffer - view.ptr;
+    return true;
+}
+
+template<typename Func>
+static void Measure(const char* name, const std::vector<char>& input, int repeat, Func f)
+{
+    std::vector<char> buffer;
+    size_t tokens = 0;
+    double seconds = 0;
+    for (int r = 0; r < repeat; ++r)
+    {
+        buffer = input;
+        char* state = buffer.data();
+        char* const end = buffer.data() + buffer.size();
+        DataView<false> view;
+        const auto start = std::chrono::steady_clock::now();
+        while (f(view, state, end))
+            ++tokens;
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    printf("%-8s %8.3f GB/s %12zu tokens\n", name, repeat * input.size() / seconds / 1e9, tokens / repeat);
+}
+
+int main(int argc, const char* argv[])
+{
+    const size_t size = argc > 1 ? (size_t)atoll(argv[1]) : ((size_t)1 << 27);
+    const size_t word_length = argc > 2 ? (size_t)atoll(argv[2]) : 6;
+    const int repeat = 5;
+
+    std::string separators = argc > 3 ? argv[3] : "\t\n\v\f\r";
+    SetSeparator(separators.c_str());
+
+    // words of average length word_length separated by space or newline
+    std::vector<char> input(size);
+    std::default_random_engine rng(0);
+    std::uniform_int_distribution<size_t> length(1, 2 * word_length - 1);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    for (size_t i = 0; i < size; )
+    {
+        for (size_t l = length(rng); l > 0 && i < size; --l)
+            input[i++] = (char)letter(rng);
+        if (i < size)
+            input[i++] = (rng() % 3 == 0) ? '\n' : ' ';
+    }
+    input.back() = '\n';
+
+    printf("%zu bytes, average word length %zu\n", size, word_length);
+    Measure("strchr", input, repeat, ReadFromStrchr);
+    for (auto engine : { Tokenizer::SCALAR, Tokenizer::SSE2, Tokenizer::AVX2 })
+    {
+        if (!Tokenizer::SetEngine(engine))
+        {
+            printf("%-8s not supported\n", Tokenizer::GetEngineName(engine));
+            continue;
+        }
+        Measure(Tokenizer::GetEngineName(engine), input, repeat,
+            [](DataView<false>& view, char*& buffer, char* end) { return view.ReadFrom(buffer, end); });
+    }
+    return 0;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdio>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <vector>
@@ -9,13 +10,21 @@
 #include <algorithm>
 #include <random>
 #include <future>
+#include <thread>
 #include <utility>
+#include <chrono>
 
 #include "Utils.h"
 #include "FileReader.h"
+#include "RunFormat.h"
+#include "InputFiles.h"
 
+/** writes the records in the human readable format, to stdout if filename is empty
+ *
+ * With async the blocks are written on another thread, see BlockWriter.
+ */
 template<typename T>
-size_t Dump(const T* begin, const T* end, const std::string& filename)
+size_t Dump(const T* begin, const T* end, const std::string& filename, bool async = false)
 {
     size_t written = 0;
     if (begin < end)
@@ -23,30 +32,144 @@ size_t Dump(const T* begin, const T* end, const std::string& filename)
         FILE* f = filename.empty() ? stdout : fopen(filename.c_str(), T::binary ? "wb" : "w");
         if (f)
         {
-            while(begin < end)
+            BlockWriter writer(f, false, output_block_size, async);
+            for (; begin < end && begin->DumpTo(writer); ++begin)
+                ++written;
+            if (!writer.Flush())
+                written = 0;
+            fclose(f);
+        }
+    }
+    return written;
+}
+
+/** writes a temporary run, text mode records go into the compact run format
+ *
+ * The run is compressed if compress is set, see BlockWriter.
+ */
+template<typename T>
+size_t DumpRun(const T* begin, const T* end, const std::string& filename, bool compress)
+{
+    size_t written = 0;
+    if (begin < end)
+    {
+        FILE* f = fopen(filename.c_str(), "wb");
+        if (f)
+        {
+            BlockWriter writer(f, compress);
+            for (; begin < end && begin->DumpTo(writer); ++begin)
             {
-                if (begin->DumpTo(f))
-                {
-                    ++written;
-                    ++begin;
-                }
-                else
-                    break;
+                writer.EndRecord();
+                ++written;
             }
+            if (!writer.Flush())
+                written = 0;
             fclose(f);
         }
     }
     return written;
 }
 
-template<typename T, typename Accumulator, typename Dumper, typename DumpCallback>
+inline size_t DumpRun(const RecordView<false>* begin, const RecordView<false>* end, const std::string& filename, bool compress)
+{
+    return begin < end ? WriteRun(begin, end, filename, compress) : 0;
+}
+
+//! calls f(0), ..., f(n-1) each on its own thread, f(0) runs on the calling thread
+template<typename Func>
+void ParallelFor(size_t n, Func f)
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n; ++i)
+        threads.emplace_back(f, i);
+    if (n > 0)
+        f((size_t)0);
+    for (auto& thread : threads)
+        thread.join();
+}
+
+/** sorts the size items into out, on n threads, by sample sort
+ *
+ * n - 1 splitters are sampled regularly from the items, every thread puts
+ * the items of its chunk into the n buckets between the splitters (by
+ * binary search), the buckets are filled chunk by chunk, so the items of a
+ * bucket keep their order. Then every thread sorts one bucket with
+ * sort_bucket(begin, end, bucket), it should be stable.
+ * before should be a total order (no two items are equal, ties are broken
+ * by the place of the items), then the output does not depend on n.
+ */
+template<typename T, typename Before, typename SortBucket>
+void ParallelSampleSort(const T* items, size_t size, T* out, size_t n, Before before, SortBucket sort_bucket)
+{
+    // 64 samples for every bucket
+    std::vector<T> samples(64 * n);
+    for (size_t s = 0; s < samples.size(); ++s)
+        samples[s] = items[s * size / samples.size()];
+    std::sort(samples.begin(), samples.end(), before);
+    std::vector<T> splitters;
+    for (size_t b = 1; b < n; ++b)
+        splitters.push_back(samples[b * samples.size() / n]);
+
+    std::vector<size_t> chunks(n + 1);
+    for (size_t c = 0; c <= n; ++c)
+        chunks[c] = c * size / n;
+    std::vector<uint32_t> buckets(size);
+    std::vector<size_t> counts(n * n); // of chunk c in bucket b at [c * n + b]
+    ParallelFor(n, [&](size_t c)
+    {   // counted apart, the rows of counts may share cache lines
+        std::vector<size_t> count(n);
+        for (size_t i = chunks[c]; i < chunks[c + 1]; ++i)
+        {
+            const size_t b = std::upper_bound(splitters.begin(), splitters.end(), items[i], before) - splitters.begin();
+            buckets[i] = (uint32_t)b;
+            ++count[b];
+        }
+        std::copy(count.begin(), count.end(), counts.begin() + c * n);
+    });
+    // the place of the items of chunk c in bucket b, bucket by bucket, chunk by chunk
+    std::vector<size_t> bucket_begins(n + 1);
+    for (size_t b = 0, at = 0; b < n; ++b)
+    {
+        bucket_begins[b] = at;
+        for (size_t c = 0; c < n; ++c)
+        {
+            const size_t count = counts[c * n + b];
+            counts[c * n + b] = at;
+            at += count;
+        }
+        bucket_begins[b + 1] = at;
+    }
+    ParallelFor(n, [&](size_t c)
+    {
+        std::vector<size_t> places(counts.begin() + c * n, counts.begin() + (c + 1) * n);
+        for (size_t i = chunks[c]; i < chunks[c + 1]; ++i)
+            out[places[buckets[i]]++] = items[i];
+    });
+    ParallelFor(n, [&](size_t b)
+    {
+        sort_bucket(out + bucket_begins[b], out + bucket_begins[b + 1], b);
+    });
+}
+
+/** same as eprocess, but the BlockAccumulator gets the whole buffer at once
+ *
+ * block_accumulator(char*& begin, char* end) should process the complete
+ * records and leave begin at the first unprocessed byte.
+ * background() is asked after every call of the dumper but the last one, if
+ * it returns true, that run is written on another thread while the next buffer is read and processed,
+ * then the range returned by the dumper has to stay valid (and must not
+ * point into the input buffer) until the next call of the dumper. One run
+ * is written at a time, the dumper is called only after the previous one
+ * is done.
+ */
+template<typename T, typename BlockAccumulator, typename Dumper, typename DumpCallback>
 std::pair<std::vector<std::string>, size_t>
-eprocess(
-    size_t buffer_size, int width, const char* prefix, bool logging, bool async,
-    Accumulator accumulator, Dumper dumper, DumpCallback dump_callback)
+eprocess_blocks(
+    size_t buffer_size, int width, const char* prefix, bool logging, bool async, bool compress,
+    BlockAccumulator block_accumulator, Dumper dumper, DumpCallback dump_callback, std::function<bool()> background = nullptr)
 {
     {   //test
-        std::function<void(const T&)> accumulator_f = accumulator;
+        std::function<void(char*&, char*)> accumulator_f = block_accumulator;
         std::function<std::pair<const T*, const T*>(size_t)> dumper_f = dumper;
         std::function<void(size_t)> callback_f = dump_callback;
     }
@@ -60,14 +183,24 @@ eprocess(
     auto reader = [&]()
     {
         async_buffer.resize(buffer_size);
-        async_buffer.resize(fread(async_buffer.data(), 1, buffer_size, stdin));
+        async_buffer.resize(ReadInput(async_buffer.data(), buffer_size));
     };
 
-    T t;
     size_t unprocessed = 0; // left-overs from earlier
     size_t processed = 0; // total number of bytes processed so far
     size_t dumped;
 
+    // the run written in the background
+    std::future<size_t> writing;
+    std::string writing_name;
+    const auto written = [&]()
+    {
+        if (!writing.valid() || writing.get() > 0)
+            return true;
+        std::cerr << "Unable to write \"" << writing_name << "\"!" << std::endl;
+        return false;
+    };
+
     if (async)
     {
         reading = std::async(std::launch::async, reader);
@@ -85,7 +218,7 @@ eprocess(
         }
         else
         {
-            buffer.resize(unprocessed + fread(buffer.data() + unprocessed, 1, buffer_size, stdin));
+            buffer.resize(unprocessed + ReadInput(buffer.data() + unprocessed, buffer_size));
         }
         // finish when you cannot read any more data
         if (buffer.empty())
@@ -95,21 +228,33 @@ eprocess(
         ProgressIndicator((std::ptrdiff_t)buffer_state - processed, &buffer_state,
             1.0, "\rProcessed: %.0f bytes", logging,
             [&]() {
-            while (t.ReadFrom(buffer_state, buffer_end))
-            {
-                accumulator(t);
-            }
+            block_accumulator(buffer_state, buffer_end);
         });
         processed += std::distance(buffer.data(), buffer_state);
 
         // dump if necessary
         dumped = 0;
+        if (!written())
+        {
+            result.second = 0;
+            return result;
+        }
         const auto to_dump = dumper(buffer_size);
         const auto filename = GetFilename(filenames.size() + 1, width, prefix);
         if (to_dump.first < to_dump.second)
         {
             std::cerr << " -> " << filename;
-            dumped = Dump(to_dump.first, to_dump.second, filename);
+            if (background && background())
+            {   // counted as dumped, a failure turns up at the next spill
+                dumped = to_dump.second - to_dump.first;
+                writing_name = filename;
+                writing = std::async(std::launch::async, [to_dump, filename, compress]()
+                {
+                    return DumpRun(to_dump.first, to_dump.second, filename, compress);
+                });
+            }
+            else
+                dumped = DumpRun(to_dump.first, to_dump.second, filename, compress);
             if (dumped > 0)
             {
                 filenames.push_back(filename);
@@ -134,19 +279,24 @@ eprocess(
     dumped = 0;
     if (filenames.empty())
         std::cerr << std::endl;
+    if (!written() || InputFailed())
+    {
+        result.second = 0;
+        return result;
+    }
     const auto to_dump = dumper(0); // empty everything
     if (to_dump.first < to_dump.second)
     {
         if (filenames.empty())
         {   // no need to write in file, because there is nothing to merge with
-            dumped = Dump(to_dump.first, to_dump.second, "");
+            dumped = Dump(to_dump.first, to_dump.second, "", async);
             dumped_total += dumped;
         }
         else
         {
             const auto filename = GetFilename(0, width, prefix);
             std::cerr << " -> " << filename;
-            dumped = Dump(to_dump.first, to_dump.second, filename);
+            dumped = DumpRun(to_dump.first, to_dump.second, filename, compress);
             if (dumped > 0)
             {
                 filenames.push_back(filename);
@@ -165,68 +315,238 @@ eprocess(
     return result;
 }
 
+template<typename T, typename Accumulator, typename Dumper, typename DumpCallback>
+std::pair<std::vector<std::string>, size_t>
+eprocess(
+    size_t buffer_size, int width, const char* prefix, bool logging, bool async, bool compress,
+    Accumulator accumulator, Dumper dumper, DumpCallback dump_callback, std::function<bool()> background = nullptr)
+{
+    {   //test
+        std::function<void(const T&)> accumulator_f = accumulator;
+    }
+    T t;
+    return eprocess_blocks<T>(buffer_size, width, prefix, logging, async, compress,
+        [&](char*& buffer_state, char* buffer_end)
+        {
+            while (t.ReadFrom(buffer_state, buffer_end))
+            {
+                accumulator(t);
+            }
+        },
+        dumper, dump_callback, background);
+}
+
+//! merges the sorted [first, second) ranges into output
 template<typename T, typename Comp = std::less<T>>
+void MergeRanges(std::vector<std::pair<const T*, const T*>> ranges, std::vector<T>& output, Comp comp = Comp())
+{
+    typedef std::pair<const T*, const T*> Range;
+    ranges.erase(std::remove_if(ranges.begin(), ranges.end(),
+        [](const Range& r) { return r.first >= r.second; }), ranges.end());
+    const auto greater = [&](const Range& one, const Range& other)
+    {
+        return comp(*other.first, *one.first);
+    };
+    std::make_heap(ranges.begin(), ranges.end(), greater);
+    while (!ranges.empty())
+    {
+        std::pop_heap(ranges.begin(), ranges.end(), greater);
+        Range& top = ranges.back();
+        output.push_back(*top.first++);
+        if (top.first < top.second)
+            std::push_heap(ranges.begin(), ranges.end(), greater);
+        else
+            ranges.pop_back();
+    }
+}
+
+/** k-way merge of sorted readers with a tournament (loser) tree
+ *
+ * The current record of every reader is kept in a contiguous array, the
+ * internal nodes of the tree hold the index of the loser of the match
+ * played there, node 0 holds the overall winner.
+ * Replacing the winner replays only its path to the root, one comparison
+ * per level. Exhausted readers lose every match. A tie is kept by the
+ * current winner, so equal records are taken run by run and no comparison
+ * is spent on breaking ties (it costs a hard-to-predict branch per level).
+ * Reader should have bool next(T&), like FileReader.
+ */
+template<typename T, typename Comp = std::less<T>, typename Reader = FileReader<T>>
 class MergeSort
 {
 public:
-    typedef FileReader<T>* ReaderType;
-private:
-    typedef std::pair<T*, ReaderType> Pair;
-    // typedef std::unique_ptr<Pair> PairPtr;
-public:
+    typedef Reader* ReaderType;
+
     MergeSort(ReaderType begin, ReaderType end, Comp comparer = Comp())
-        : comp(comparer)
+        : comp(comparer), heads(end - begin), leaves(1)
     {
         for (; begin < end; ++begin)
+            readers.push_back(begin);
+        while (leaves < readers.size())
+            leaves *= 2;
+        // leaves without a reader are exhausted from the start
+        exhausted.assign(leaves, 1);
+        for (size_t i = 0; i < readers.size(); ++i)
+            exhausted[i] = !readers[i]->next(heads[i]);
+
+        // play the matches bottom-up, winners[n] is the winner below node n
+        tree.assign(leaves, 0);
+        std::vector<size_t> winners(2 * leaves);
+        for (size_t i = 0; i < leaves; ++i)
+            winners[leaves + i] = i;
+        for (size_t n = leaves - 1; n > 0; --n)
         {
-            queue.emplace_back(new T(), begin);
-            auto& p = queue.back();
-            if (p.second->next(*p.first))
+            const size_t a = winners[2 * n], b = winners[2 * n + 1];
+            const bool b_wins = Less(b, a);
+            winners[n] = b_wins ? b : a;
+            tree[n] = b_wins ? a : b;
+        }
+        tree[0] = winners[1];
+    }
+    bool next(T& t)
+    {
+        size_t winner = tree[0];
+        if (exhausted[winner])
+            return false;
+        t = std::move(heads[winner]);
+        if (readers[winner]->next(heads[winner]))
+        {   // replay the path of the winner, it stays live on the way up
+            for (size_t n = (leaves + winner) / 2; n > 0; n /= 2)
             {
-                //queue.emplace_back( new Pair(t, begin));
-                std::push_heap(queue.begin(), queue.end(), comp);
+                const size_t loser = tree[n];
+                if (!exhausted[loser] && comp(heads[loser], heads[winner]))
+                {
+                    tree[n] = winner;
+                    winner = loser;
+                }
             }
-            else
+        }
+        else
+        {   // once per reader
+            exhausted[winner] = 1;
+            for (size_t n = (leaves + winner) / 2; n > 0; n /= 2)
             {
-                delete p.first;
-                queue.pop_back();
+                if (Less(tree[n], winner))
+                    std::swap(tree[n], winner);
             }
-                
         }
+        tree[0] = winner;
+        return true;
+    }
+private:
+    //! whether leaf i beats leaf j, the one already in place (j) keeps a tie
+    bool Less(size_t i, size_t j)const
+    {
+        if (exhausted[i] || exhausted[j])
+            return !exhausted[i];
+        return comp(heads[i], heads[j]);
+    }
+
+    const Comp comp;
+    std::vector<ReaderType> readers;
+    std::vector<T> heads; //!< the current record of every reader
+    std::vector<char> exhausted; //!< one for each leaf
+    size_t leaves; //!< number of readers rounded up to a power of two
+    std::vector<size_t> tree;
+};
+
+/** MergeSort of '\0' terminated text records in byte order, with offset-value coding
+ *
+ * Every head knows the length of its common prefix with the last record
+ * put out (its offset) and its byte after that. The heads on the path of
+ * the last winner are all coded relative to the same record, so of two
+ * heads the one with the larger offset is the smaller, and at equal
+ * offsets the smaller byte decides. Only equal codes need the keys.
+ * The offset of a new head is the prefix it shares with the record before
+ * it in the same run, which is the record just put out (Reader::Shared).
+ */
+template<typename T, typename Reader = FileReader<T>>
+class PrefixMerge
+{
+public:
+    typedef Reader* ReaderType;
+
+    PrefixMerge(ReaderType begin, ReaderType end)
+        : heads(end - begin), leaves(1)
+    {
+        for (; begin < end; ++begin)
+            readers.push_back(begin);
+        while (leaves < readers.size())
+            leaves *= 2;
+        exhausted.assign(leaves, 1);
+        codes.assign(leaves, 0);
+        for (size_t i = 0; i < readers.size(); ++i)
+        {   // coded relative to the empty record at first
+            exhausted[i] = !readers[i]->next(heads[i]);
+            if (!exhausted[i])
+                codes[i] = Code(i, 0);
+        }
+
+        tree.assign(leaves, 0);
+        std::vector<size_t> winners(2 * leaves);
+        for (size_t i = 0; i < leaves; ++i)
+            winners[leaves + i] = i;
+        for (size_t n = leaves - 1; n > 0; --n)
+        {
+            const size_t a = winners[2 * n], b = winners[2 * n + 1];
+            const bool b_wins = Beats(b, a);
+            winners[n] = b_wins ? b : a;
+            tree[n] = b_wins ? a : b;
+        }
+        tree[0] = winners[1];
     }
     bool next(T& t)
     {
-        if (queue.empty())
+        size_t winner = tree[0];
+        if (exhausted[winner])
             return false;
-        // pop-heap
-        std::pop_heap(queue.begin(), queue.end(), comp);
-        // top is at back() now
-        Pair& top = queue.back();
-        // retrieve top
-        t = std::move(*top.first);
-        // try to retrieve next from the very same FileReader who produced the previous top
-        if (top.second->next(*top.first))
-        {   // re-heap with the newly read element
-            std::push_heap(queue.begin(), queue.end(), comp);
-        }
-        else 
-        {   // remove the exhausted FileReader
-            delete top.first;
-            queue.pop_back();
+        t = std::move(heads[winner]);
+        if (readers[winner]->next(heads[winner]))
+            codes[winner] = Code(winner, readers[winner]->Shared());
+        else
+            exhausted[winner] = 1;
+        for (size_t n = (leaves + winner) / 2; n > 0; n /= 2)
+        {
+            if (Beats(tree[n], winner))
+                std::swap(tree[n], winner);
         }
+        tree[0] = winner;
         return true;
     }
 private:
-    struct grt
+    //! larger codes are smaller records, the byte is inverted
+    size_t Code(size_t i, size_t offset)const
     {
-        grt(Comp comparer) : comp(comparer) {}
-        bool operator()(const Pair& one, const Pair& other)const
+        const auto& view = heads[i].view;
+        return offset < view.size ? (offset << 8) | (255 - (unsigned char)view.ptr[offset]) : offset << 8;
+    }
+    //! whether leaf i beats leaf j (j keeps a tie), the loser is coded relative to the winner
+    bool Beats(size_t i, size_t j)
+    {
+        if (exhausted[i] || exhausted[j])
+            return !exhausted[i];
+        if (codes[i] != codes[j])
+            return codes[i] > codes[j];
+        const auto& a = heads[i].view;
+        const auto& b = heads[j].view;
+        const size_t size = std::min(a.size, b.size);
+        const size_t offset = std::min(codes[i] >> 8, size);
+        const size_t n = offset + CommonPrefix(a.ptr + offset, b.ptr + offset, size - offset);
+        if (n < size && (unsigned char)a.ptr[n] < (unsigned char)b.ptr[n])
         {
-            return comp(*other.first, *one.first); // actually smallest is the greatest priority
+            codes[j] = Code(j, n);
+            return true;
         }
-        const Comp comp;
-    } comp;
-    std::vector<Pair> queue;
+        codes[i] = Code(i, n);
+        return false;
+    }
+
+    std::vector<ReaderType> readers;
+    std::vector<T> heads; //!< the current record of every reader
+    std::vector<char> exhausted; //!< one for each leaf
+    std::vector<size_t> codes; //!< offset and byte of the heads relative to the last record put out
+    size_t leaves; //!< number of readers rounded up to a power of two
+    std::vector<size_t> tree;
 };
 
 template<typename T>
@@ -258,3 +578,102 @@ private:
     std::vector<ReaderType> queue;
     std::default_random_engine generator;
 };
+
+//! a sorted run to be merged
+struct RunFile
+{
+    std::string name;
+    size_t size; //!< in bytes
+    bool do_delete; //!< delete it after it is read
+};
+
+inline std::vector<RunFile> MakeRunFiles(const std::vector<std::string>& filenames, bool do_delete)
+{
+    std::vector<RunFile> result;
+    for (const auto& filename : filenames)
+        result.push_back(RunFile{ filename, GetFileSize(filename), do_delete });
+    return result;
+}
+
+/** the number of records in the files, from the headers of their frames
+ *
+ * The merge of earlier runs (-m) knows the total this way, if they are
+ * compressed.
+ * @return 0 if any of the files is not compressed
+ */
+inline size_t CompressedRecords(const std::vector<std::string>& filenames)
+{
+    size_t total = 0;
+    for (const auto& filename : filenames)
+    {
+        size_t size, records;
+        if (!ScanFrames(filename, size, records))
+            return 0;
+        total += records;
+    }
+    return total;
+}
+
+/** default number of runs merged at once
+ *
+ * A merge keeps a read block (see ReadBlockSize) and an open file for every
+ * run: at least 16 runs, more as memory allows, within the open file limit
+ * (some files are left for stdin, stdout and the run being written).
+ */
+inline size_t DefaultFanIn(size_t memory)
+{
+    const size_t open_files = MaxOpenFiles();
+    const size_t by_files = open_files > 32 ? open_files - 16 : 2;
+    return std::max<size_t>(2, std::min(std::max<size_t>(memory / (1 << 16), 16), by_files));
+}
+
+/** merges the runs in passes, until at most fan_in are left for the final merge
+ *
+ * Every pass merges the smallest runs into a new one, like building a
+ * Huffman tree of degree fan_in: only the first pass can merge fewer than
+ * fan_in runs, so the number of passes and the volume rewritten are minimal.
+ * merge_into(runs, output) merges runs into the new run output, deleting
+ * the runs with do_delete as it finishes them, and returns false on failure.
+ * The new runs are named "<prefix>m001.tmp" and so on and they are deleted
+ * after being merged, regardless of do_delete.
+ * @return the runs left, empty on failure
+ */
+template<typename MergeInto>
+std::vector<RunFile> CascadeMerge(std::vector<RunFile> runs, size_t fan_in,
+    int width, const char* prefix, bool logging, MergeInto merge_into)
+{
+    fan_in = std::max<size_t>(fan_in, 2);
+    const auto larger = [](const RunFile& one, const RunFile& other) { return one.size > other.size; };
+    std::make_heap(runs.begin(), runs.end(), larger);
+    const std::string run_prefix = std::string(prefix) + "m";
+    size_t pass = 0;
+    while (runs.size() > fan_in)
+    {
+        const size_t n = pass == 0 ? (runs.size() - 2) % (fan_in - 1) + 2 : fan_in;
+        std::vector<RunFile> inputs;
+        size_t input_size = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            std::pop_heap(runs.begin(), runs.end(), larger);
+            inputs.push_back(runs.back());
+            input_size += runs.back().size;
+            runs.pop_back();
+        }
+        ++pass;
+        const RunFile output{ GetFilename(pass, width, run_prefix.c_str()), 0, true };
+        const auto start = std::chrono::steady_clock::now();
+        if (!merge_into(inputs, output.name))
+        {
+            std::cerr << "Unable to write \"" << output.name << "\"!" << std::endl;
+            return std::vector<RunFile>();
+        }
+        runs.push_back(output);
+        runs.back().size = GetFileSize(output.name);
+        if (logging)
+            fprintf(stderr, "Merge pass %zu: %zu runs, %.1f MB -> %.1f MB, %.3f s, %zu runs left\n",
+                pass, n, input_size / 1e6, runs.back().size / 1e6,
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), runs.size());
+        std::push_heap(runs.begin(), runs.end(), larger);
+    }
+    return runs;
+}
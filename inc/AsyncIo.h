@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <future>
+
+/** asynchronous reads and writes of the files opened by the tools
+ *
+ * The temporary runs are written and the merged files are read with
+ * several chunks in flight, so the sorting and merging does not wait for
+ * the disk. With uring the requests go to io_uring (Linux), if the kernel
+ * does not allow it, or with threads, every request is done by pread or
+ * pwrite on a thread of its own. sync (the default) leaves the files to
+ * stdio and mmap, see BlockReader and BlockWriter.
+ * With direct the files are read and written with O_DIRECT (where the
+ * file system supports it) in aligned chunks, so the temporary data does
+ * not push the input out of the page cache.
+ * stdin and stdout are never read or written this way.
+ */
+enum class IoBackend
+{
+    sync,
+    uring,
+    threads,
+};
+
+//! chooses the backend, falls back to threads if io_uring is not available, returns the one used
+IoBackend SetAsyncIo(IoBackend backend, bool direct);
+IoBackend AsyncIoBackend();
+bool AsyncIoDirect();
+//! name of the backend, for the logs
+const char* IoBackendName(IoBackend backend);
+//! "sync", "uring" or "threads", false for anything else
+bool ParseIoBackend(const char* name, IoBackend& backend);
+
+//! whether f is a regular file to be read or written by the async backend
+bool UseAsyncIo(FILE* f);
+
+/** a fixed number of requests in flight, each in a slot
+ *
+ * A slot is submitted, then completed (waited for) before it is
+ * submitted again. The completions can be waited for in any order.
+ */
+class IoQueue
+{
+public:
+    explicit IoQueue(size_t depth);
+    ~IoQueue();
+    IoQueue(const IoQueue&) = delete;
+    IoQueue& operator=(const IoQueue&) = delete;
+
+    //! starts reading size bytes at offset into buffer
+    void Read(size_t slot, int fd, char* buffer, size_t size, uint64_t offset);
+    void Write(size_t slot, int fd, const char* buffer, size_t size, uint64_t offset);
+    //! waits for the slot, returns the bytes done or -errno
+    long long Complete(size_t slot);
+    bool Busy(size_t slot)const
+    {
+        return busy[slot] != 0;
+    }
+    size_t Depth()const
+    {
+        return busy.size();
+    }
+    //! whether the kernel gives io_uring to this process
+    static bool RingAvailable();
+
+private:
+    void Submit(size_t slot, bool write, int fd, char* buffer, size_t size, uint64_t offset);
+
+    struct Ring;
+    std::unique_ptr<Ring> ring; //!< null if the requests go to threads
+    std::vector<char> busy; //!< submitted, not completed yet
+    std::vector<char> reaped; //!< done by the kernel, not completed yet
+    std::vector<long long> results;
+    std::vector<std::future<long long>> threads;
+};
+
+//! chunks in flight per file
+static const size_t async_io_depth = 4;
+
+/** reads a file from offset on, the next chunks are read ahead
+ *
+ * Read copies out of the chunks in the order of the file.
+ */
+class AsyncReader
+{
+public:
+    AsyncReader(int fd, uint64_t offset, size_t chunk_size, bool direct);
+    //! returns the bytes read, less than size only at the end of the file (or on error)
+    size_t Read(char* out, size_t size);
+
+private:
+    void Submit(size_t slot);
+
+    IoQueue queue;
+    const int fd;
+    const size_t chunk_size;
+    std::unique_ptr<char[]> storage;
+    char* chunks; //!< depth chunks, aligned
+    std::vector<size_t> sizes; //!< bytes in the chunks read
+    size_t current; //!< the slot read from
+    size_t pos; //!< in the current chunk
+    uint64_t next; //!< offset of the next chunk to submit
+    bool done; //!< a chunk came back short, nothing is submitted after it
+};
+
+/** writes a file from offset on, the chunks are written while the next ones are filled
+ *
+ * With direct only full chunks are written with O_DIRECT, Flush writes
+ * the partial chunk without it (and the rest of the file too).
+ */
+class AsyncWriter
+{
+public:
+    AsyncWriter(int fd, uint64_t offset, size_t chunk_size, bool direct);
+    ~AsyncWriter();
+    bool Write(const char* data, size_t size);
+    //! writes out the partial chunk and waits for all the chunks
+    bool Flush();
+
+private:
+    //! submits the current chunk, the next one is waited for
+    void Submit();
+    void Wait(size_t slot);
+
+    IoQueue queue;
+    const int fd;
+    const size_t chunk_size;
+    std::unique_ptr<char[]> storage;
+    char* chunks;
+    std::vector<size_t> sizes; //!< bytes submitted from the chunks
+    std::vector<uint64_t> offsets; //!< where they go in the file
+    size_t current; //!< the slot filled
+    size_t used; //!< in the current chunk
+    uint64_t offset; //!< of the current chunk in the file
+    bool direct, failed;
+};
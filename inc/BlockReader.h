@@ -0,0 +1,243 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <string>
+#include <algorithm>
+
+#include "Lz.h"
+#include "AsyncIo.h"
+
+/** reads a file in large blocks and hands out records in place
+ *
+ * A regular file is mapped into memory as a whole, the records point into
+ * the mapping (MAP_PRIVATE, so the terminators written into them do not
+ * reach the file) and the pages behind the records in use are released as
+ * the reading proceeds. Other files (pipes given to -m) and platforms
+ * without mmap use two blocks, filled in turns. A record which is completely in a
+ * block is returned as a pointer into that block, only the records
+ * straddling the end of a block are copied, into a spill buffer given by
+ * the caller (the Packet being read).
+ * Compressed files (see BlockWriter) are recognized by their magic, they
+ * are decompressed frame by frame into the blocks.
+ * With an asynchronous backend (see AsyncIo.h) regular files are not
+ * mapped, they are read ahead by an AsyncReader into the blocks.
+ * A returned record stays valid during the next call, so a merge can keep
+ * the current record of a run while it reads the following one.
+ * Until and Take start a new record, Get continues the last one.
+ * The records are writable, the byte after them (the terminator in the
+ * file or an extra byte of the spill buffer) belongs to the record, it can
+ * be overwritten with a '\0'.
+ */
+class BlockReader
+{
+public:
+    static const size_t alignment = 4096;
+
+    explicit BlockReader(FILE* f = nullptr, size_t block_size = 1 << 16)
+        : f(f), block_size(std::max((size_t)alignment, block_size / alignment * alignment)),
+        block(nullptr), current(1), pos(0), end(0), switched(false),
+        mapping(nullptr), mapped(0), released(0), last(0), compressed(false), pending(0)
+    {
+        Open();
+    }
+    BlockReader(BlockReader&& other);
+    BlockReader(const BlockReader&) = delete;
+    BlockReader& operator=(const BlockReader&) = delete;
+    ~BlockReader();
+
+    /** the next record up to delimiter, delimiter is consumed
+     *
+     * The last record of the file does not need a delimiter.
+     * @return nullptr at the end of the file
+     */
+    char* Until(char delimiter, size_t& size, std::vector<char>& spill)
+    {
+        Begin();
+        char* const block = Block();
+        char* found = (char*)memchr(block + pos, delimiter, end - pos);
+        if (found)
+        {
+            char* const result = block + pos;
+            size = found - result;
+            pos = found - block + 1;
+            return result;
+        }
+        // straddles a block boundary
+        spill.assign(block + pos, block + end);
+        while (Fill())
+        {
+            char* const next = Block();
+            found = (char*)memchr(next, delimiter, end);
+            if (found)
+            {
+                pos = found - next + 1;
+                spill.insert(spill.end(), next, found + 1);
+                size = spill.size() - 1;
+                return spill.data();
+            }
+            spill.insert(spill.end(), next, next + end);
+        }
+        if (spill.empty())
+            return nullptr;
+        size = spill.size();
+        spill.push_back('\0');
+        return spill.data();
+    }
+
+    //! the next size bytes, nullptr if the file ends before
+    char* Take(size_t size, std::vector<char>& spill)
+    {
+        Begin();
+        if (end - pos >= size)
+        {
+            char* const result = Block() + pos;
+            pos += size;
+            return result;
+        }
+        spill.assign(Block() + pos, Block() + end);
+        while (spill.size() < size)
+        {
+            if (!Fill())
+                return nullptr;
+            const size_t n = std::min(size - spill.size(), end);
+            spill.insert(spill.end(), Block(), Block() + n);
+            pos = n;
+        }
+        return spill.data();
+    }
+
+    //! copies the next size bytes into out, returns the number of bytes copied, like fread
+    size_t Read(char* out, size_t size)
+    {
+        Begin();
+        size_t done = 0;
+        while (done < size && (pos < end || Fill()))
+        {
+            const size_t n = std::min(size - done, end - pos);
+            memcpy(out + done, Block() + pos, n);
+            pos += n;
+            done += n;
+        }
+        return done;
+    }
+
+    //! consumes the beginning of the file if it is prefix
+    bool StartsWith(const char* prefix, size_t size)
+    {
+        if (pos == end && end == 0)
+            Fill();
+        if (end - pos >= size && memcmp(Block() + pos, prefix, size) == 0)
+        {
+            pos += size;
+            return true;
+        }
+        return false;
+    }
+
+protected:
+    //! the next byte of a record or EOF
+    int Get()
+    {
+        if (pos == end && !Fill())
+            return EOF;
+        return (unsigned char)Block()[pos++];
+    }
+
+    /** starts a new record
+     *
+     * The previous record may be in the current block, the first refill
+     * of a record goes to the other block, the rest to the same one.
+     */
+    void Begin()
+    {
+        switched = false;
+        if (mapping)
+        {   // the record returned last starts at last, the ones before are done
+            if (last - released >= release_size)
+                Release();
+            last = pos;
+        }
+    }
+
+private:
+    //! pages are given back to the system in steps of this size
+    static const size_t release_size = 1 << 20;
+
+    char* Block()
+    {
+        return block;
+    }
+    bool Fill()
+    {
+        if (mapping)
+            return false;
+        if (!switched)
+        {
+            current ^= 1;
+            switched = true;
+        }
+        char* const base = storage.get();
+        block = base + (alignment - (uintptr_t)base % alignment) % alignment + current * block_size;
+        pos = 0;
+        if (compressed)
+            end = Unpack(block);
+        else
+        {   // the bytes read while looking for the magic come first
+            memcpy(block, head, pending);
+            end = pending + ReadFile(block + pending, block_size - pending);
+            pending = 0;
+        }
+        return end > 0;
+    }
+    //! the bytes of the file, through the AsyncReader if there is one
+    size_t ReadFile(char* out, size_t size)
+    {
+        if (input)
+            return input->Read(out, size);
+        return f ? fread(out, 1, size, f) : 0;
+    }
+    //! recognizes compressed files, maps or allocates the blocks
+    void Open();
+    //! maps the rest of f if it is a regular file, the whole file is a single block then
+    bool Map();
+    //! decompresses the next frame into out, returns its size, 0 at the end or on error
+    size_t Unpack(char* out);
+    //! releases the pages before the record returned last
+    void Release();
+
+    FILE* f;
+    size_t block_size;
+    std::unique_ptr<char[]> storage; //!< the blocks, aligned to alignment, not initialized
+    char* block; //!< the current block
+    size_t current, pos, end;
+    bool switched; //!< the current record has refilled a block already
+    char* mapping;
+    size_t mapped, released, last; //!< size of the mapping, end of the released pages, start of the last record
+    bool compressed;
+    std::vector<char> packed; //!< the current frame of a compressed file
+    char head[sizeof(lz_magic)];
+    size_t pending; //!< bytes in head, which could not be put back into f (a pipe)
+    std::unique_ptr<AsyncReader> input; //!< reads f ahead, see AsyncIo.h
+};
+
+/** reads the frame headers of a compressed file
+ *
+ * size is the size of the decompressed contents, records is the number
+ * of records, as counted by the writer.
+ * @return false if the file is not compressed or not seekable (a pipe)
+ */
+bool ScanFrames(const std::string& filename, size_t& size, size_t& records);
+
+/** size of the blocks when n files are read at once
+ *
+ * The blocks of a merge are kept around 2MiB in total: larger blocks are
+ * evicted from the cache by their own reads before the merge gets to them.
+ */
+inline size_t ReadBlockSize(size_t n)
+{
+    return std::min<size_t>(std::max<size_t>((1 << 20) / std::max<size_t>(n, 1), 1 << 14), 1 << 18);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <future>
+
+#include "Lz.h"
+#include "Utils.h"
+#include "AsyncIo.h"
+
+/** writes a file through a block buffer, optionally compressed
+ *
+ * The compressed files are written in frames of lz_frame_size bytes (see
+ * Lz.h), the blocks are compressed on the writing thread.
+ * BlockReader recognizes the compressed files by their magic and
+ * decompresses them, so the readers are the same for both.
+ * EndRecord counts the records for the frame headers.
+ *
+ * On unix the blocks go to the file descriptor with writev, past the
+ * buffer of the FILE (nothing else should write to the FILE meanwhile).
+ * With background set, a full block is written (and compressed) by
+ * another thread while the next one is filled.
+ * With an asynchronous backend (see AsyncIo.h) regular files are written
+ * by an AsyncWriter, several chunks at once.
+ */
+class BlockWriter
+{
+public:
+    explicit BlockWriter(FILE* f, bool compress = false, size_t block_size = 1 << 16, bool background = false);
+    ~BlockWriter();
+    BlockWriter(BlockWriter&&) = default;
+
+    bool Write(const char* data, size_t size)
+    {
+        while (used + size > block.size())
+        {   // a record may straddle the blocks
+            const size_t n = block.size() - used;
+            memcpy(block.data() + used, data, n);
+            used += n;
+            data += n;
+            size -= n;
+            if (!Pass())
+                return false;
+        }
+        memcpy(block.data() + used, data, size);
+        used += size;
+        return true;
+    }
+    bool Put(char c)
+    {
+        if (used == block.size() && !Pass())
+            return false;
+        block[used++] = c;
+        return true;
+    }
+    //! v in decimal, see FormatDecimal
+    bool PutDecimal(uint64_t v)
+    {
+        if (block.size() - used < 20)
+        {
+            char digits[20];
+            return Write(digits, FormatDecimal(v, digits));
+        }
+        used += FormatDecimal(v, block.data() + used);
+        return true;
+    }
+    void EndRecord()
+    {
+        ++records;
+    }
+    //! writes out the buffered bytes (waits for the background writes), the file is not flushed
+    bool Flush();
+
+private:
+    //! hands the block over to be written
+    bool Pass();
+    //! writes a block, compressed if needed
+    bool WriteBlock(const char* data, size_t size, uint32_t block_records);
+
+    FILE* f;
+    std::vector<char> block, packed;
+    std::vector<char> spare; //!< the block being written in the background
+    size_t used;
+    uint32_t records; //!< records ending in the current block
+    bool compress, started, background, failed;
+    std::future<bool> writing;
+    std::unique_ptr<AsyncWriter> output; //!< writes f, see AsyncIo.h
+};
+
+//! block size of the outputs (on stdout)
+static const size_t output_block_size = 1 << 20;
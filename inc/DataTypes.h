@@ -5,6 +5,9 @@
 #include <cstdlib>
 #include <cstring>
 
+#include "Tokenizer.h"
+#include "BlockWriter.h"
+
 template<bool binary>
 struct DataView;
 
@@ -32,6 +35,11 @@ struct DataView<true>
     {
         return fwrite(ptr, size, 1, f) == 1;
     }
+    //! into a temporary run
+    inline bool DumpTo(BlockWriter& w)const noexcept
+    {
+        return w.Write(ptr, size);
+    }
     inline bool operator<(const DataView& other)const noexcept
     {
         return memcmp(ptr, other.ptr, size) < 0;
@@ -55,11 +63,10 @@ struct DataView<false>
     DataView() : ptr(nullptr), size(0) {}
     inline bool ReadFrom(char*& buffer, char* end)noexcept
     {
-        while (buffer < end && strchr(separators, *buffer) != NULL)
+        while (buffer < end && Tokenizer::IsSeparator(*buffer))
             *buffer++ = '\0';
         ptr = buffer;
-        while (buffer < end && strchr(separators, *buffer) == NULL)
-            ++buffer;
+        buffer = (char*)Tokenizer::FindSeparator(buffer, end);
         if (buffer == end)
         {   // no separator at the end, setting back to last known place
             size = 0;
@@ -80,6 +87,11 @@ struct DataView<false>
         //return fprintf(f, "%s%c", ptr, separators[0]) > 0;
         return fwrite(ptr, size - 1, 1, f) == 1 && fputc(separators[0], f) != EOF;
     }
+    //! into a temporary run
+    inline bool DumpTo(BlockWriter& w)const noexcept
+    {
+        return w.Write(ptr, size - 1) && w.Put(separators[0]);
+    }
 
     inline bool operator<(const DataView& other)const
     {
@@ -97,13 +109,18 @@ struct DataView<false>
 
 typedef std::vector<char> Buffer;
 
+class BlockReader;
+class RunReader;
+
 template<bool binary>
 struct RecordView : DataView<binary>
 {
     // char* ReadFrom(char*& buffer, char* end);
     inline bool DumpTo(FILE* f)const noexcept;
+    inline bool DumpTo(BlockWriter& w)const noexcept;
 
     size_t count;
+    size_t hash; //!< KeyHash of the key, set by the hash tables
     static char separator;
     // inherits lexicographic operator< from DataView
     // inherits operator== from DataView
@@ -149,10 +166,32 @@ public:
         return view < other.view;
     }
 
-    bool ReadFrom(FILE* f);
+    /** the next record, see BlockReader
+     *
+     * The view points into the blocks of the reader, or into the packet if
+     * the record straddles a block boundary.
+     */
+    bool ReadFrom(BlockReader& reader);
+    //! from a temporary run, see RunFormat.h
+    bool ReadFrom(RunReader& run);
+    //! copies the record into the packet, to keep it longer than the reader
+    void Own()
+    {
+        if (view.ptr != data())
+        {
+            assign(view.ptr, view.ptr + view.size);
+            view.ptr = data();
+        }
+    }
     T view;
 };
 
+// text mode records are read from runs too, see RunFormat.h
+template<>
+bool Packet<RecordView<false>>::ReadFrom(BlockReader& reader);
+template<>
+bool Packet<RecordView<false>>::ReadFrom(RunReader& run);
+
 template<>
 inline bool RecordView<true>::DumpTo(FILE * f) const noexcept
 {
@@ -162,12 +201,21 @@ inline bool RecordView<true>::DumpTo(FILE * f) const noexcept
 template<>
 inline bool RecordView<false>::DumpTo(FILE * f) const noexcept
 {
+    char digits[21];
+    const size_t n = FormatDecimal(count, digits);
+    digits[n] = '\n';
     return fwrite(ptr, size - 1, 1, f) == 1 && fputc(separator, f) != EOF &&
-        fprintf(f,
-#if defined(_MSC_VER) && _MSC_VER < 1900 
-        "%Iu\n"
-#else
-        "%zu\n"
-#endif
-        , count) > 0;
+        fwrite(digits, n + 1, 1, f) == 1;
+}
+
+template<>
+inline bool RecordView<true>::DumpTo(BlockWriter& w) const noexcept
+{
+    return w.Write(this->ptr, this->size) && w.Write((const char*)&count, sizeof(count));
+}
+
+template<>
+inline bool RecordView<false>::DumpTo(BlockWriter& w) const noexcept
+{
+    return w.Write(ptr, size - 1) && w.Put(separator) && w.PutDecimal(count) && w.Put('\n');
 }
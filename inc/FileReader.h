@@ -4,17 +4,24 @@
 #include <vector>
 #include <string>
 
+#include "BlockReader.h"
+
+/** reads the records of a file one by one
+ *
+ * The records are read through a BlockReader, they may point into its
+ * blocks, see there how long they are valid.
+ */
 template<typename T>
 struct FileReader
 {
-    FileReader(const std::string& fname, bool del)
-        : f(fopen(fname.c_str(), T::binary ? "rb" : "r")), filename(fname),
-        do_delete(del)
+    FileReader(const std::string& fname, bool del, size_t block_size = 1 << 16)
+        : f(fopen(fname.c_str(), "rb")), filename(fname),
+        do_delete(del), reader(f, block_size)
     {
     }
     bool next(T& t)
     {
-        if (t.ReadFrom(f))
+        if (t.ReadFrom(reader))
             return true;
         else
         {
@@ -33,4 +40,5 @@ private:
         if (do_delete)
             remove(filename.c_str());
     }
+    BlockReader reader;
 };
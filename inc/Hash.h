@@ -5,101 +5,389 @@
 #include <algorithm>
 
 #include "DataTypes.h"
+#include "StringSort.h"
+#include "Utils.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define HASH_SSE2
+#   include <emmintrin.h>
+#endif
+
+//! the bytes of the key, in the order of the records (without the terminating '\0')
 template<bool binary>
-class HashTable
+struct RecordKey
+{
+    std::pair<const char*, size_t> operator()(const RecordView<binary>& record)const
+    {
+        return std::make_pair(record.ptr, binary ? record.size : record.size - 1);
+    }
+};
+
+//! counters for comparing the hash table engines
+struct HashStats
+{
+    size_t lookups; //!< number of inserts
+    size_t probes; //!< number of slots (or groups of slots) visited
+    size_t compares; //!< number of full key comparisons
+
+    HashStats() : lookups(0), probes(0), compares(0) {}
+};
+
+/** which one of the n partitions a hash belongs to
+ *
+ * Uses the middle bits of the hash, the lowest ones select the slot and
+ * the highest ones are the tags in GroupHashTable.
+ */
+inline size_t HashPartition(size_t hash, size_t n)
+{
+    return (size_t)((((uint64_t)hash >> 8) & 0xFFFFFFFFu) * n >> 32);
+}
+
+/** the slots of the hash table engines, a plain array of records
+ *
+ * The records cache the hash of their key, the engines re-build their
+ * probing structure from them. The operations which move the records
+ * around (sorting, partitioning) are shared, they leave the table invalid
+ * until the next rehash of the engine. rehash() re-builds the table in
+ * place, expands it if it is too full, it does nothing if the table is
+ * intact and does not need to grow.
+ */
+template<bool binary>
+class SlotTable
 {
 public:
     size_t actual_size;
     typedef RecordView<binary> value_type;
     typedef DataView<binary> key_type;
-private:
+protected:
     std::vector<value_type> hash_table;
     const double rehash_constant, expand_constant;
-    size_t remainder_size;
+    HashStats stats;
+    bool valid; //!< false if the slots were sorted
+
+    SlotTable(double rehash_factor, double expand_factor)
+    :   actual_size(0),
+        rehash_constant(rehash_factor), expand_constant(expand_factor),
+        valid(true)
+    {}
+    //! the number of slots needed at the next rehash
+    size_t NextSize()const
+    {
+        return actual_size < rehash_constant*hash_table.size() ? hash_table.size() : (size_t)ceil(expand_constant*hash_table.size());
+    }
+/** @defgroup functions public member functions
+*  @{
+*/
+public:
+    void SortFreqDescent()
+    {
+        static struct 
+        {
+            bool operator()(const value_type& one, const value_type& other)const
+            {
+                return one.count > other.count;
+            }
+        } less;
+        std::sort(hash_table.begin(), hash_table.end(), less);
+        valid = false;
+    }
+
+    /** moves the records, for which keep(record) holds, to the front, the rest of the records after them
+     *
+     * keep is called exactly once for every record, in slot order.
+     * Returns the number of kept records.
+     */
+    template<typename Predicate>
+    size_t Partition(Predicate keep)
+    {
+        size_t live = 0, kept = 0;
+        for (size_t i = 0; i < hash_table.size(); ++i)
+        {
+            if (hash_table[i].ptr)
+            {
+                if (i != live)
+                {
+                    hash_table[live] = hash_table[i];
+                    hash_table[i] = value_type();
+                }
+                ++live;
+            }
+        }
+        for (size_t i = 0; i < live; ++i)
+        {
+            if (keep(hash_table[i]))
+                std::swap(hash_table[kept++], hash_table[i]);
+        }
+        valid = false;
+        return kept;
+    }
+
+    //! radix sort, the keys are unique
+    void SortLexicographic(size_t from = 0)
+    {
+        StringSort(hash_table.data() + from, hash_table.data() + actual_size, RecordKey<binary>());
+        valid = false;
+    }
+
+    size_t GetAllocatedSize()const { return hash_table.size(); }
+    size_t GetSize()const { return actual_size; }
+    //! the slots may be modified only after sorting and until the next rehash
+    value_type* GetTable(){ return hash_table.data(); }
+    const value_type* GetTable()const { return hash_table.data(); }
+    const HashStats& GetStats()const { return stats; }
+
+/** @} */
+};
+
+//! linear probing, see SlotTable
+template<bool binary>
+class HashTable : public SlotTable<binary>
+{
+public:
+    using SlotTable<binary>::actual_size;
+    typedef RecordView<binary> value_type;
+    typedef DataView<binary> key_type;
+private:
+    using SlotTable<binary>::hash_table;
+    using SlotTable<binary>::stats;
+    using SlotTable<binary>::valid;
+
+    std::vector<bool> placed; //!< used in rehash
     
 /** @defgroup functions public member functions
 *  @{
 */
 public:
     HashTable(size_t size, double rehash_factor, double expand_factor)
-    :   actual_size(0),
-        rehash_constant(rehash_factor), expand_constant(expand_factor)
+    :   SlotTable<binary>(rehash_factor, expand_factor)
     {
         hash_table.resize(std::max<size_t>(1, size));
     }
+    //! see SlotTable
     void rehash()
     {
-        value_type *new_bucket;
-        const size_t new_table_size = (actual_size < rehash_constant*hash_table.size() ? hash_table.size() : (size_t)ceil(expand_constant*hash_table.size()));
-        size_t new_hash_val, i;
-        std::vector<value_type> new_table(new_table_size);
-        for (const auto& bucket : hash_table)
+        const size_t new_table_size = this->NextSize();
+        if (valid && new_table_size == hash_table.size())
+            return;
+        hash_table.resize(new_table_size);
+        placed.assign(new_table_size, false);
+        for (size_t k = 0; k < new_table_size; ++k)
         {
-            if (bucket.ptr)
-            {   // non empty bucket
-                new_hash_val = Fnv1a::hash(bucket.ptr, bucket.size) % new_table_size;
-                i = new_hash_val;
-                do
-                {
-                    new_bucket = new_table.data() + i;
-                    if (new_bucket->ptr == nullptr)
-                    {   // found an empty bucket
-                        *new_bucket = bucket;
-                        break;
-                    }
+            if (hash_table[k].ptr == nullptr || placed[k])
+                continue;
+            // take it out and put it to its place, carry on with the one found there
+            value_type bucket = hash_table[k];
+            hash_table[k] = value_type();
+            while (true)
+            {
+                size_t i = bucket.hash % new_table_size;
+                while (placed[i])
                     i = (i + 1) % new_table_size; // circular try
-                } while (i != new_hash_val);
+                placed[i] = true;
+                if (hash_table[i].ptr == nullptr)
+                {   // found an empty bucket
+                    hash_table[i] = bucket;
+                    break;
+                }
+                std::swap(bucket, hash_table[i]);
             }
         }
-        std::swap(hash_table, new_table);
+        valid = true;
     }
 
     void insert(const key_type& str)
     {
-        const size_t supposed_to_be = Fnv1a::hash(str.ptr, str.size) % hash_table.size();
+        insert(str, KeyHash::hash(str.ptr, str.size));
+    }
+    //! hash should be KeyHash::hash of str, count is added to the count of str
+    void insert(const key_type& str, size_t hash, size_t count = 1)
+    {
+        const size_t supposed_to_be = hash % hash_table.size();
         value_type* where;
         size_t i = supposed_to_be;
+        ++stats.lookups;
         do
         {
             where = hash_table.data() + i;
+            ++stats.probes;
             if (where->ptr == nullptr)
             {
                 static_cast<key_type&>(*where) = str;
-                where->count = 1;
+                where->count = count;
+                where->hash = hash;
                 ++actual_size;
                 return;
             }
-            else if (*where == str)
+            if (where->hash == hash)
             {
-                ++(where->count);
-                return;
+                ++stats.compares;
+                if (*where == str)
+                {
+                    where->count += count;
+                    return;
+                }
             }
             i = (i + 1) % hash_table.size();
         } while (i != supposed_to_be); // cyclic try until it goes a full circle
     }
 
-    void SortFreqDescent()
+/** @} */
+};
+
+/** open addressing with a separate control byte per slot
+ *
+ * The slots are organized in groups of 16, a control byte is either empty
+ * or holds 7 bits of the hash of the key in that slot.
+ * A whole group is matched against the tag at once and keys are
+ * compared only where the tag matches.
+ * The slots are a SlotTable, just like in HashTable, the control bytes
+ * are re-built from the slots (and their cached hashes) in rehash.
+ */
+template<bool binary>
+class GroupHashTable : public SlotTable<binary>
+{
+public:
+    using SlotTable<binary>::actual_size;
+    typedef RecordView<binary> value_type;
+    typedef DataView<binary> key_type;
+    static constexpr size_t group_size = 16;
+private:
+    using SlotTable<binary>::hash_table;
+    using SlotTable<binary>::stats;
+    using SlotTable<binary>::valid;
+
+    static constexpr unsigned char empty = 0x80;
+    static constexpr unsigned char unplaced = 0xFE; //!< used in rehash
+
+    std::vector<unsigned char> control;
+
+    static size_t GroupsFor(size_t size)
     {
-        static struct 
+        return std::max<size_t>(1, (size + group_size - 1) / group_size);
+    }
+    //! upper 7 bits, the lower bits select the group
+    static unsigned char Tag(size_t hash)
+    {
+        return (unsigned char)(hash >> (8 * sizeof(size_t) - 7));
+    }
+    //! bit i is set iff group[i] == byte
+    static uint32_t Match(const unsigned char* group, unsigned char byte)
+    {
+#ifdef HASH_SSE2
+        return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*)group), _mm_set1_epi8((char)byte)));
+#else
+        uint32_t result = 0;
+        for (size_t i = 0; i < group_size; ++i)
+            result |= uint32_t(group[i] == byte) << i;
+        return result;
+#endif
+    }
+/** @defgroup functions public member functions
+*  @{
+*/
+public:
+    GroupHashTable(size_t size, double rehash_factor, double expand_factor)
+    :   SlotTable<binary>(rehash_factor, expand_factor)
+    {
+        hash_table.resize(GroupsFor(size) * group_size);
+        control.assign(hash_table.size(), empty);
+    }
+    //! see SlotTable
+    void rehash()
+    {
+        const size_t new_table_size = GroupsFor(this->NextSize()) * group_size;
+        if (valid && new_table_size == hash_table.size())
+            return;
+        hash_table.resize(new_table_size);
+        control.resize(new_table_size);
+        for (size_t k = 0; k < new_table_size; ++k)
+            control[k] = hash_table[k].ptr ? unplaced : empty;
+
+        const size_t groups = new_table_size / group_size;
+        for (size_t k = 0; k < new_table_size; ++k)
         {
-            bool operator()(const value_type& one, const value_type& other)const
+            if (control[k] != unplaced)
+                continue;
+            // take it out and put it to its place, carry on with the one found there
+            value_type bucket = hash_table[k];
+            hash_table[k] = value_type();
+            control[k] = empty;
+            while (true)
             {
-                return one.count > other.count;
+                size_t g = bucket.hash % groups;
+                uint32_t free;
+                while (!(free = Match(control.data() + g * group_size, empty) |
+                                Match(control.data() + g * group_size, unplaced)))
+                {
+                    if (++g == groups)
+                        g = 0;
+                }
+                const size_t i = g * group_size + CountTrailingZeros(free);
+                const bool occupied = control[i] == unplaced;
+                control[i] = Tag(bucket.hash);
+                if (!occupied)
+                {
+                    hash_table[i] = bucket;
+                    break;
+                }
+                std::swap(bucket, hash_table[i]);
             }
-        } less;
-        std::sort(hash_table.begin(), hash_table.end(), less);
+        }
+        valid = true;
     }
 
-    void SortLexicographic(size_t from = 0)
+    void insert(const key_type& str)
     {
-        std::sort(hash_table.begin() + from, hash_table.begin() + actual_size);
+        insert(str, KeyHash::hash(str.ptr, str.size));
+    }
+    //! hash should be KeyHash::hash of str, count is added to the count of str
+    void insert(const key_type& str, size_t hash, size_t count = 1)
+    {
+        const size_t groups = control.size() / group_size;
+        const unsigned char tag = Tag(hash);
+        size_t g = hash % groups;
+        ++stats.lookups;
+        for (size_t n = 0; n < groups; ++n)
+        {
+            unsigned char* group = control.data() + g * group_size;
+            value_type* const slots = hash_table.data() + g * group_size;
+            ++stats.probes;
+            for (uint32_t match = Match(group, tag); match; match &= match - 1)
+            {
+                value_type* where = slots + CountTrailingZeros(match);
+                if (where->hash == hash)
+                {
+                    ++stats.compares;
+                    if (*where == str)
+                    {
+                        where->count += count;
+                        return;
+                    }
+                }
+            }
+            const uint32_t free = Match(group, empty);
+            if (free)
+            {
+                const size_t i = CountTrailingZeros(free);
+                group[i] = tag;
+                static_cast<key_type&>(slots[i]) = str;
+                slots[i].count = count;
+                slots[i].hash = hash;
+                ++actual_size;
+                return;
+            }
+            if (++g == groups)
+                g = 0;
+        }
     }
-
-    size_t GetAllocatedSize()const { return hash_table.size(); }
-    size_t GetSize()const { return actual_size; }
-    value_type* GetTable(){ return hash_table.data(); }
-    const value_type* GetTable()const { return hash_table.data(); }
 
 /** @} */
 };
+
+template<bool binary>
+constexpr size_t GroupHashTable<binary>::group_size;
+template<bool binary>
+constexpr unsigned char GroupHashTable<binary>::empty;
+template<bool binary>
+constexpr unsigned char GroupHashTable<binary>::unplaced;
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/** the input of the tools: stdin, or the files given on the command line
+ *
+ * The files are read as if they were concatenated (like cat does), so the
+ * records are the same as on stdin. The regular files are cut into byte
+ * ranges of about range_size, every range is moved to the next record
+ * boundary (after a separator, or to a whole record in binary mode), so it
+ * holds whole records. The reader threads read the ranges with pread, at
+ * most two ranges per reader are in memory, and Read hands them over in
+ * the order of the files.
+ * Pipes (and "-" for stdin) are read by Read itself, when they come.
+ */
+class InputFiles
+{
+public:
+    InputFiles(const std::vector<std::string>& names, size_t readers, size_t record_size, size_t range_size = 1 << 22);
+    ~InputFiles();
+    InputFiles(const InputFiles&) = delete;
+    InputFiles& operator=(const InputFiles&) = delete;
+
+    //! opens the files, false if one of them cannot be opened (the error is printed)
+    bool Open();
+    //! returns the bytes read, less than size only at the end of the input (or on error)
+    size_t Read(char* out, size_t size);
+    bool Failed()const
+    {
+        return failed;
+    }
+
+private:
+    struct File
+    {
+        std::string name;
+        FILE* f;
+        uint64_t size;
+        bool stream; //!< read in turn, not in ranges
+    };
+    //! the nominal byte range, before it is moved to the record boundaries
+    struct Range
+    {
+        size_t file;
+        uint64_t begin, end;
+    };
+    struct Slot
+    {
+        std::vector<char> data;
+        size_t range; //!< the range loaded, npos if none
+        bool failed;
+    };
+
+    void Reader();
+    //! reads the range into the slot, false on error
+    bool Load(const Range& range, std::vector<char>& data)const;
+    //! the first record boundary at or after offset
+    bool Boundary(const File& file, uint64_t offset, uint64_t& boundary)const;
+    //! the current range is consumed, its slot is freed
+    void Next();
+
+    std::vector<File> files;
+    std::vector<Range> ranges;
+    const size_t readers, record_size, range_size;
+    std::vector<Slot> slots;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable loaded, freed;
+    size_t claimed; //!< the next range to be taken by a reader
+    size_t current; //!< the range read from
+    size_t pos; //!< in the current range
+    bool started, stopped, failed;
+};
+
+//! the input of eprocess: these files, or stdin if names is empty, false if one cannot be opened
+bool SetInput(const std::vector<std::string>& names, size_t readers, size_t record_size);
+//! reads the input set by SetInput, stdin by default
+size_t ReadInput(char* out, size_t size);
+//! whether one of the input files could not be read
+bool InputFailed();
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstring>
+
+/** slab allocator for the keys, which outlive their input buffer
+ *
+ * Keys are copied into the arena once, when their input buffer is about to
+ * be overwritten, and stay at the same place as long as they live.
+ * After a spill, Collect finds the slabs which became sparse (their garbage
+ * ratio is above max_garbage) and only their live keys are moved, then
+ * those slabs are released.
+ * There are two generations: new keys are bump-allocated into young slabs,
+ * keys moved by a compaction are promoted to old slabs, so the long living
+ * (frequent) keys end up next to each other and their slabs stay dense.
+ */
+class KeyArena
+{
+public:
+    struct Stats
+    {
+        size_t collected; //!< bytes copied into the arena from input buffers
+        size_t moved; //!< bytes moved by compaction
+        size_t released; //!< number of released (sparse or empty) slabs
+        Stats() : collected(0), moved(0), released(0) {}
+    };
+
+    KeyArena(size_t slab_size, double max_garbage);
+
+    /** copies the keys of the records into the arena, if they are not already there
+     *
+     * Records with ptr == nullptr are skipped, the rest are considered live,
+     * every other key in the arena is garbage.
+     */
+    template<typename Record>
+    void Collect(Record* begin, Record* end)
+    {
+        for (auto& slab : slabs)
+        {
+            slab->live = 0;
+            slab->victim = false;
+        }
+        for (auto rec = begin; rec < end; ++rec)
+        {
+            if (rec->ptr)
+            {
+                Slab* slab = Find(rec->ptr);
+                if (slab)
+                    slab->live += rec->size;
+            }
+        }
+        for (auto& slab : slabs)
+            slab->victim = slab->live < (1.0 - max_garbage) * slab->used;
+        for (auto& current : generations)
+        {
+            if (current && current->victim)
+                current = nullptr;
+        }
+
+        for (auto rec = begin; rec < end; ++rec)
+        {
+            if (rec->ptr)
+            {
+                Slab* slab = Find(rec->ptr);
+                if (slab == nullptr)
+                {
+                    rec->ptr = Copy(rec->ptr, rec->size, YOUNG);
+                    stats.collected += rec->size;
+                }
+                else if (slab->victim)
+                {
+                    rec->ptr = Copy(rec->ptr, rec->size, OLD);
+                    stats.moved += rec->size;
+                }
+            }
+        }
+        Release();
+    }
+
+    //! total size of the slabs
+    size_t GetAllocated()const { return allocated; }
+    /** allocated, but not live memory, as of the last Collect
+     *
+     * The free end of the slabs which are being filled is not counted, new
+     * keys go there, so a freshly allocated slab is no overhead.
+     */
+    size_t GetOverhead()const;
+    const Stats& GetStats()const { return stats; }
+
+private:
+    enum Generation
+    {
+        YOUNG,
+        OLD,
+    };
+
+    struct Slab
+    {
+        std::unique_ptr<char[]> data;
+        size_t size, used, live;
+        bool victim;
+
+        explicit Slab(size_t s) : data(new char[s]), size(s), used(0), live(0), victim(false) {}
+    };
+
+    //! the slab containing ptr or nullptr if it is not in the arena
+    Slab* Find(const char* ptr)const;
+    const char* Copy(const char* ptr, size_t size, Generation generation);
+    //! frees the victims and updates the counters
+    void Release();
+
+    const size_t slab_size;
+    const double max_garbage;
+    std::vector<std::unique_ptr<Slab>> slabs; //!< ordered by address
+    Slab* generations[2]; //!< bump allocation happens here
+    size_t allocated, live;
+    Stats stats;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/** a small, self-contained LZ77 block codec for the temporary runs
+ *
+ * The compressed block is a sequence of token, literals, offset, match:
+ * the high 4 bits of the token are the number of literals, the low 4 bits
+ * the length of the match minus 4 (15 means that more length bytes
+ * follow, each adds its value and a 255 means one more byte), the offset is
+ * 2 bytes, little endian. The last sequence has literals only, the last 5
+ * bytes of a block are always literals.
+ * It trades ratio for speed, the runs are written once and read once.
+ */
+
+//! the worst case size of the compressed block
+inline size_t LzBound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+/** compresses [src, src + size) into dst
+ *
+ * @return the compressed size, 0 if capacity is less than LzBound(size)
+ */
+size_t LzCompress(const char* src, size_t size, char* dst, size_t capacity);
+
+/** decompresses a block of size bytes, which was raw_size long
+ *
+ * @return false if the block is corrupt, it never writes past dst + raw_size
+ */
+bool LzDecompress(const char* src, size_t size, char* dst, size_t raw_size);
+
+/** framing of the compressed files (--compress-temp)
+ *
+ * A compressed file starts with lz_magic, then every frame is an LzFrame
+ * (in native byte order, the runs do not leave the machine) followed by
+ * the packed bytes. A frame holds at most lz_frame_size bytes of the
+ * original file, it is stored as it is if it does not compress
+ * (packed == size). records is the number of records ending in the frame,
+ * so the records of a run can be counted without decompressing it.
+ */
+static const char lz_magic[8] = { '\0', 'e', 'l', 'z', '\x01', '\0', '\r', '\n' };
+static const size_t lz_frame_size = 1 << 16;
+
+struct LzFrame
+{
+    uint32_t size, packed, records;
+};
@@ -0,0 +1,323 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "DataTypes.h"
+#include "FileReader.h"
+#include "BlockReader.h"
+#include "BlockWriter.h"
+#include "Utils.h"
+
+/** compact format of the temporary runs of text mode ecollect and esort
+ *
+ * A run starts with one of the magics below, then every record is
+ * key varint(count).
+ * Text keys are terminated by a '\0' (which is always a separator, so it
+ * is not part of any key), like in RecordView, so the records can be used
+ * right where they are read (see BlockReader). Binary keys (in the
+ * partitions of the grace mode) have the fixed binary size.
+ * Varints are little endian base 128 (7 bits per byte, the highest bit
+ * means that more bytes follow).
+ * The sorted text runs are front coded: every key is
+ * varint(shared) suffix '\0', where shared is the length of the common
+ * prefix with the previous key. Every restart_interval-th key is stored
+ * whole (shared is 0), so a damaged key does not spoil the rest of the run.
+ * The runs of esort have no counts (front_coded_keys_magic).
+ * The output on stdout stays human readable, this is used for runs only.
+ * With --compress-temp the whole run (magic included) is compressed by
+ * BlockWriter.
+ */
+static const char run_magic[8] = { '\0', 'e', 'r', 'u', 'n', '\x02', '\r', '\n' };
+static const char front_coded_magic[8] = { '\0', 'e', 'r', 'u', 'n', '\x03', '\r', '\n' };
+static const char front_coded_keys_magic[8] = { '\0', 'e', 'r', 'u', 'n', '\x04', '\r', '\n' };
+static const size_t restart_interval = 16;
+
+inline char* PutVarint(uint64_t v, char* out)
+{
+    while (v >= 0x80)
+    {
+        *out++ = (char)(v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (char)v;
+    return out;
+}
+
+//! false if the varint is not complete before end
+inline bool GetVarint(const char*& p, const char* end, uint64_t& v)
+{
+    v = 0;
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7)
+    {
+        const unsigned char c = (unsigned char)*p++;
+        v |= (uint64_t)(c & 0x7F) << shift;
+        if (c < 0x80)
+            return true;
+    }
+    return false;
+}
+
+//! length of the common prefix of a and b, both are at least size long
+inline size_t CommonPrefix(const char* a, const char* b, size_t size)
+{
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+    {   // the first difference is the lowest one (little endian)
+        uint32_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        if (x != y)
+            return i + CountTrailingZeros(x ^ y) / 8;
+    }
+    while (i < size && a[i] == b[i])
+        ++i;
+    return i;
+}
+
+//! writes records into a run through a BlockWriter, the run starts with its magic
+class RunWriter
+{
+public:
+    /** front_coded is for sorted text keys only
+     *
+     * Without counts only the keys are stored (the runs of esort).
+     */
+    explicit RunWriter(FILE* f, bool binary = false, bool compress = false, bool front_coded = false, bool counts = true)
+        : writer(f, compress), terminator(binary ? 0 : 1), front_coded(front_coded && !binary), counts(counts), written(0)
+    {
+        if (this->front_coded)
+            writer.Write(counts ? front_coded_magic : front_coded_keys_magic, sizeof(run_magic));
+        else
+            writer.Write(run_magic, sizeof(run_magic));
+    }
+    //! size is without the terminating '\0' in text mode
+    bool Write(const char* key, size_t size, uint64_t count)
+    {
+        size_t shared = 0;
+        bool result = true;
+        if (front_coded)
+        {
+            if (written % restart_interval != 0)
+                shared = CommonPrefix(last.data(), key, std::min(last.size(), size));
+            char head[10];
+            result = writer.Write(head, PutVarint(shared, head) - head);
+            last.assign(key, key + size);
+        }
+        char tail[11] = { '\0' };
+        const char* const end = counts ? PutVarint(count, tail + terminator) : tail + terminator;
+        result = result && writer.Write(key + shared, size - shared) && writer.Write(tail, end - tail);
+        writer.EndRecord();
+        ++written;
+        return result;
+    }
+    bool Flush()
+    {
+        return writer.Flush();
+    }
+private:
+    BlockWriter writer;
+    const size_t terminator;
+    const bool front_coded, counts;
+    size_t written;
+    std::vector<char> last; //!< the previous key of a front coded run
+};
+
+//! parses records of a run, see BlockReader
+class RunReader : public BlockReader
+{
+public:
+    //! key_size is the size of the binary keys, 0 in text mode
+    explicit RunReader(FILE* f = nullptr, size_t key_size = 0, size_t block_size = 1 << 16)
+        : BlockReader(f, block_size), key_size(key_size), front_coded(false), counts(true),
+        previous(nullptr), previous_size(0), shared(0)
+    {
+    }
+    //! consumes the magic, false if the file is not a run
+    bool ReadMagic()
+    {
+        if (StartsWith(run_magic, sizeof(run_magic)))
+            return true;
+        counts = !StartsWith(front_coded_keys_magic, sizeof(front_coded_keys_magic));
+        front_coded = !counts || StartsWith(front_coded_magic, sizeof(front_coded_magic));
+        return front_coded;
+    }
+    bool FrontCoded()const
+    {
+        return front_coded;
+    }
+    /** the length of the common prefix of the last key and the one before
+     *
+     * Terminators included, equal keys share size + 1 bytes. Front coded
+     * runs only.
+     */
+    size_t Shared()const
+    {
+        return shared;
+    }
+    //! the key is valid until the next call
+    bool Next(const char*& key, size_t& size, uint64_t& count)
+    {
+        char* result;
+        if (!Next(result, size, count, spill))
+            return false;
+        key = result;
+        return true;
+    }
+    /** the key is valid during the next call too
+     *
+     * It is copied into spill if it straddles a block boundary, or if it is
+     * front coded (the prefix comes from the previous key).
+     * Text keys are followed by their '\0', size is without it.
+     * count is 1 in the runs without counts.
+     */
+    bool Next(char*& key, size_t& size, uint64_t& count, std::vector<char>& spill)
+    {
+        count = 1;
+        if (key_size)
+        {
+            key = Take(key_size, spill);
+            size = key_size;
+        }
+        else if (front_coded)
+            key = Decode(size, spill);
+        else
+            key = Until('\0', size, spill);
+        return key && (!counts || Varint(count));
+    }
+private:
+    //! GetVarint from the blocks
+    bool Varint(uint64_t& v)
+    {
+        v = 0;
+        int c;
+        for (unsigned shift = 0; shift < 64 && (c = Get()) != EOF; shift += 7)
+        {
+            v |= (uint64_t)(c & 0x7F) << shift;
+            if (c < 0x80)
+                return true;
+        }
+        return false;
+    }
+    //! puts the prefix of the previous key and the suffix together in spill
+    char* Decode(size_t& size, std::vector<char>& spill)
+    {
+        uint64_t prefix;
+        size_t n;
+        Begin();
+        if (!Varint(prefix) || prefix > previous_size)
+            return nullptr;
+        const char* const rest = Until('\0', n, suffix);
+        if (rest == nullptr)
+            return nullptr;
+        size = (size_t)prefix + n;
+        // a restart point, rest is followed by its '\0' too
+        if (prefix == 0 && previous)
+            shared = CommonPrefix(previous, rest, std::min(previous_size, n) + 1);
+        else
+            shared = (size_t)prefix + (prefix == previous_size && n == 0 ? 1 : 0);
+        // spill may hold the previous key already (reading into the same packet)
+        const bool in_place = previous == spill.data();
+        if (spill.size() <= size)
+            spill.resize(size + 1); // never shrinks, the packets swap their buffers
+        if (!in_place && prefix > 0)
+            memcpy(spill.data(), previous, (size_t)prefix);
+        memcpy(spill.data() + prefix, rest, n);
+        spill[size] = '\0';
+        previous = spill.data();
+        previous_size = size;
+        return spill.data();
+    }
+
+    const size_t key_size;
+    bool front_coded, counts;
+    std::vector<char> spill, suffix;
+    const char* previous; //!< the previous key of a front coded run
+    size_t previous_size, shared;
+};
+
+//! writes the records into a new run, returns the number of records written
+inline size_t WriteRun(const RecordView<false>* begin, const RecordView<false>* end, const std::string& filename, bool compress)
+{
+    size_t written = 0;
+    FILE* f = fopen(filename.c_str(), "wb");
+    if (f)
+    {
+        RunWriter writer(f, false, compress, true);
+        for (; begin < end && writer.Write(begin->ptr, begin->size - 1, begin->count); ++begin)
+            ++written;
+        if (!writer.Flush())
+            written = 0;
+        fclose(f);
+    }
+    return written;
+}
+
+/** reads text mode records from a run or from a human readable file
+ *
+ * The format is decided by the first bytes of the file, so that -m can
+ * merge both the temporary runs and the earlier outputs.
+ * Shared() gives the common prefix of the last record with the one before,
+ * see PrefixMerge. It is free in the front coded runs.
+ */
+template<typename T>
+struct RunFileReader
+{
+    RunFileReader(const std::string& fname, bool del, size_t block_size = 1 << 16)
+        : f(fopen(fname.c_str(), "rb")), filename(fname),
+        do_delete(del), reader(f, 0, block_size), is_run(reader.ReadMagic()),
+        previous(nullptr), previous_size(0), shared(0)
+    {
+    }
+    bool next(T& t)
+    {
+        if (is_run ? t.ReadFrom(reader) : t.ReadFrom(static_cast<BlockReader&>(reader)))
+        {
+            if (reader.FrontCoded())
+                shared = reader.Shared();
+            else
+                shared = previous ? CommonPrefix(previous, t.view.ptr, std::min(previous_size, t.view.size)) : 0;
+            previous = t.view.ptr;
+            previous_size = t.view.size;
+            return true;
+        }
+        else
+        {
+            Close();
+            return false;
+        }
+    }
+    //! the common prefix of the last record and the one before, terminators included
+    size_t Shared()const
+    {
+        return shared;
+    }
+    FILE* f;
+    const std::string filename;
+    const bool do_delete;
+private:
+    void Close()
+    {
+        fclose(f);
+        f = NULL;
+        if (do_delete)
+            remove(filename.c_str());
+    }
+    RunReader reader;
+    bool is_run;
+    const char* previous; //!< the previous record, valid during the next call
+    size_t previous_size, shared;
+};
+
+template<>
+struct FileReader<Packet<RecordView<false>>> : RunFileReader<Packet<RecordView<false>>>
+{
+    FileReader(const std::string& fname, bool del, size_t block_size = 1 << 16)
+        : RunFileReader(fname, del, block_size)
+    {
+    }
+};
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+
+#include "DataTypes.h"
+#include "Utils.h"
+
+/** approximate counting of the most frequent keys in a fixed number of counters
+ *
+ * Space-Saving algorithm (Metwally, Agrawal, El Abbadi 2005): a key without
+ * a counter takes over the counter with the smallest count and inherits its
+ * count as error.
+ * Every key occurring more than GetTotal() / capacity times has a counter,
+ * the count of a counter overestimates the frequency of its key by at most
+ * its error.
+ * The counters are in a min-heap by count and they are found by their key
+ * in an open addressing index (linear probing, backward shift deletion).
+ */
+template<bool binary>
+class SpaceSaving
+{
+public:
+    typedef RecordView<binary> value_type;
+    typedef DataView<binary> key_type;
+
+private:
+    struct Counter
+    {
+        std::string key; //!< in text mode with the terminating '\0'
+        key_type view; //!< points to key
+        size_t count, error, hash;
+        uint32_t heap; //!< position in the heap
+    };
+
+    std::vector<Counter> counters;
+    std::vector<uint32_t> heap; //!< counter indices, min-heap by count
+    std::vector<uint32_t> index; //!< counter index + 1, 0 is empty
+    const size_t capacity;
+    size_t mask, total;
+
+    bool Equals(const Counter& counter, const key_type& str, size_t hash)const
+    {
+        return counter.hash == hash && counter.key.size() == str.size &&
+            memcmp(counter.key.data(), str.ptr, str.size) == 0;
+    }
+    //! slot of the counter c in the index
+    size_t Slot(uint32_t c)const
+    {
+        size_t i = counters[c].hash & mask;
+        while (index[i] != c + 1)
+            i = (i + 1) & mask;
+        return i;
+    }
+    void Erase(size_t i)
+    {
+        for (size_t j = (i + 1) & mask; index[j]; j = (j + 1) & mask)
+        {
+            const size_t home = counters[index[j] - 1].hash & mask;
+            // move back, unless its home is cyclically in (i, j]
+            if (((j - home) & mask) >= ((j - i) & mask))
+            {
+                index[i] = index[j];
+                i = j;
+            }
+        }
+        index[i] = 0;
+    }
+    static void Assign(Counter& counter, const key_type& str, size_t hash)
+    {
+        counter.key.assign(str.ptr, str.size);
+        counter.view = str;
+        counter.view.ptr = counter.key.data();
+        counter.hash = hash;
+    }
+    void Place(uint32_t c)
+    {
+        size_t i = counters[c].hash & mask;
+        while (index[i])
+            i = (i + 1) & mask;
+        index[i] = c + 1;
+    }
+    //! restores the heap after a counter with the smallest count is added at position p
+    void SiftUp(size_t p)
+    {
+        const uint32_t c = heap[p];
+        const size_t count = counters[c].count;
+        while (p > 0 && counters[heap[(p - 1) / 2]].count > count)
+        {
+            heap[p] = heap[(p - 1) / 2];
+            counters[heap[p]].heap = (uint32_t)p;
+            p = (p - 1) / 2;
+        }
+        heap[p] = c;
+        counters[c].heap = (uint32_t)p;
+    }
+    //! restores the heap after the count at position p is increased
+    void SiftDown(size_t p)
+    {
+        const uint32_t c = heap[p];
+        const size_t count = counters[c].count;
+        while (true)
+        {
+            size_t child = 2 * p + 1;
+            if (child >= heap.size())
+                break;
+            if (child + 1 < heap.size() && counters[heap[child + 1]].count < counters[heap[child]].count)
+                ++child;
+            if (counters[heap[child]].count >= count)
+                break;
+            heap[p] = heap[child];
+            counters[heap[p]].heap = (uint32_t)p;
+            p = child;
+        }
+        heap[p] = c;
+        counters[c].heap = (uint32_t)p;
+    }
+
+/** @defgroup functions public member functions
+*  @{
+*/
+public:
+    explicit SpaceSaving(size_t capacity)
+    :   capacity(std::max<size_t>(1, std::min<size_t>(capacity, UINT32_MAX / 2))),
+        total(0)
+    {
+        size_t slots = 1;
+        while (slots < 2 * this->capacity)
+            slots *= 2;
+        index.assign(slots, 0);
+        mask = slots - 1;
+        counters.reserve(this->capacity);
+        heap.reserve(this->capacity);
+    }
+
+    void insert(const key_type& str)
+    {
+        insert(str, KeyHash::hash(str.ptr, str.size));
+    }
+    //! hash should be KeyHash::hash of str
+    void insert(const key_type& str, size_t hash)
+    {
+        ++total;
+        for (size_t i = hash & mask; index[i]; i = (i + 1) & mask)
+        {
+            Counter& counter = counters[index[i] - 1];
+            if (Equals(counter, str, hash))
+            {
+                ++counter.count;
+                SiftDown(counter.heap);
+                return;
+            }
+        }
+        if (counters.size() < capacity)
+        {   // a new counter, its count 1 is the smallest possible
+            const uint32_t c = (uint32_t)counters.size();
+            counters.emplace_back(); // never reallocates, see reserve
+            Assign(counters[c], str, hash);
+            counters[c].count = 1;
+            counters[c].error = 0;
+            heap.push_back(c);
+            Place(c);
+            SiftUp(heap.size() - 1);
+        }
+        else
+        {   // take over the smallest one
+            const uint32_t c = heap.front();
+            Counter& counter = counters[c];
+            Erase(Slot(c));
+            Assign(counter, str, hash);
+            counter.error = counter.count++;
+            Place(c);
+            SiftDown(0);
+        }
+    }
+
+    /** the keys with count at least min_count, in lexicographic order
+     *
+     * The counts (upper bounds) go to counts, the errors to errors, pointing
+     * to the same keys, which are valid until the next insert.
+     */
+    void GetRecords(size_t min_count, std::vector<value_type>& counts, std::vector<value_type>& errors)const
+    {
+        std::vector<const Counter*> selected;
+        for (const auto& counter : counters)
+        {
+            if (counter.count >= min_count)
+                selected.push_back(&counter);
+        }
+        std::sort(selected.begin(), selected.end(), [](const Counter* one, const Counter* other)
+        {
+            return one->view < other->view;
+        });
+        counts.resize(selected.size());
+        errors.resize(selected.size());
+        for (size_t i = 0; i < selected.size(); ++i)
+        {
+            static_cast<key_type&>(counts[i]) = selected[i]->view;
+            counts[i].hash = selected[i]->hash;
+            errors[i] = counts[i];
+            counts[i].count = selected[i]->count;
+            errors[i].count = selected[i]->error;
+        }
+    }
+
+    //! number of inserted keys
+    size_t GetTotal()const { return total; }
+    size_t GetCapacity()const { return capacity; }
+    size_t GetSize()const { return counters.size(); }
+    //! upper bound of the frequency of the keys without a counter
+    size_t GetMinCount()const { return counters.size() < capacity ? 0 : counters[heap.front()].count; }
+    //! largest overestimation among the counters
+    size_t GetMaxError()const
+    {
+        size_t result = 0;
+        for (const auto& counter : counters)
+            result = std::max(result, counter.error);
+        return result;
+    }
+    //! bytes used by the counters, the index and the keys
+    size_t GetMemory()const
+    {
+        size_t result = counters.capacity() * sizeof(Counter) +
+            (heap.capacity() + index.capacity()) * sizeof(uint32_t);
+        for (const auto& counter : counters)
+            result += counter.key.capacity();
+        return result;
+    }
+
+/** @} */
+};
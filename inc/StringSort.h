@@ -0,0 +1,212 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+/** stable MSD radix sort of records by a byte string key
+ *
+ * key(record) returns the key as a (pointer, size) pair, the records are
+ * ordered like memcmp orders the keys, a key before its extensions.
+ * The sort works on an array of (8 byte key prefix, record) entries, the
+ * prefix is big-endian, so comparing two prefixes compares 8 bytes of the
+ * keys at once. The entries are distributed by one byte of the prefix at a
+ * time (counting sort into a second array, so it is stable), small buckets
+ * are sorted by insertion sort. When the 8 bytes of a bucket are used up,
+ * the keys which ended are put first, the prefix of the rest is loaded from
+ * the next 8 bytes of their keys. The keys are read only when the prefixes
+ * are loaded and when two equal prefixes are compared by insertion sort.
+ * Finally the records are moved to their place, through a copy. The
+ * key is read only before that, so it may depend on the place of the
+ * record in the array.
+ * Records with equal keys keep their order.
+ */
+template<typename T, typename Key>
+class StringSorter
+{
+public:
+    explicit StringSorter(Key key) : key(key) {}
+
+    void Sort(T* begin, T* end)
+    {
+        const size_t n = end - begin;
+        if (n < 2)
+            return;
+        entries.resize(n);
+        buffer.resize(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            entries[i].item = begin + i;
+            entries[i].prefix = Prefix(begin[i], 0);
+        }
+        Radix(entries.data(), buffer.data(), n, 0, 56, 0);
+        Permute(begin);
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t prefix; //!< 8 bytes of the key from the depth of its bucket, 0 padded
+        T* item;
+    };
+    static const size_t cutoff = 32; //!< buckets smaller than this are sorted by insertion sort
+    static const size_t max_level = 64; //!< deeper buckets are sorted by comparison
+
+    //! the 8 bytes of the key from depth, big-endian
+    uint64_t Prefix(const T& item, size_t depth)const
+    {
+        const auto k = key(item);
+        const unsigned char* p = (const unsigned char*)k.first + depth;
+        uint64_t prefix = 0;
+        if (depth + 8 <= k.second)
+        {
+            for (size_t i = 0; i < 8; ++i)
+                prefix = prefix << 8 | p[i];
+            return prefix;
+        }
+        for (size_t i = 0; i < 8; ++i)
+            prefix = prefix << 8 | (depth + i < k.second ? p[i] : 0);
+        return prefix;
+    }
+    //! the keys are equal before depth
+    bool Less(const Entry& a, const Entry& b, size_t depth)const
+    {
+        if (a.prefix != b.prefix)
+            return a.prefix < b.prefix;
+        const auto ka = key(*a.item), kb = key(*b.item);
+        const size_t from = depth + 8;
+        if (ka.second <= from || kb.second <= from)
+            return ka.second < kb.second;
+        const int c = memcmp(ka.first + from, kb.first + from, std::min(ka.second, kb.second) - from);
+        return c < 0 || (c == 0 && ka.second < kb.second);
+    }
+    void Insertion(Entry* a, size_t n, size_t depth)const
+    {
+        for (size_t i = 1; i < n; ++i)
+        {
+            const Entry x = a[i];
+            size_t j = i;
+            for (; j > 0 && Less(x, a[j - 1], depth); --j)
+                a[j] = a[j - 1];
+            a[j] = x;
+        }
+    }
+    /** sorts n entries with equal keys before the byte of the prefix at shift
+     *
+     * tmp has room for n entries. The bytes, which are the same in all the
+     * prefixes, are skipped, if the prefixes are equal, the next 8 bytes of
+     * the keys are taken in the same call.
+     */
+    void Radix(Entry* a, Entry* tmp, size_t n, size_t depth, int shift, size_t level)
+    {
+        while (true)
+        {
+            if (n < cutoff)
+            {
+                Insertion(a, n, depth);
+                return;
+            }
+            if (level >= max_level)
+            {   // a long chain of small splits
+                std::stable_sort(a, a + n, [&](const Entry& x, const Entry& y) { return Less(x, y, depth); });
+                return;
+            }
+            // the bytes, in which the prefixes differ, the ones before shift are equal
+            uint64_t diff = 0;
+            for (size_t i = 1; i < n; ++i)
+                diff |= a[i].prefix ^ a[0].prefix;
+            if (shift < 56)
+                diff &= ((uint64_t)1 << (shift + 8)) - 1;
+            if (diff != 0)
+            {
+                while (((diff >> shift) & 0xFF) == 0)
+                    shift -= 8;
+                size_t count[256] = {};
+                for (size_t i = 0; i < n; ++i)
+                    ++count[(a[i].prefix >> shift) & 0xFF];
+                size_t start[256];
+                for (size_t b = 0, sum = 0; b < 256; ++b)
+                {
+                    start[b] = sum;
+                    sum += count[b];
+                }
+                for (size_t i = 0; i < n; ++i)
+                    tmp[start[(a[i].prefix >> shift) & 0xFF]++] = a[i];
+                std::copy(tmp, tmp + n, a);
+                for (size_t b = 0, begin = 0; b < 256; begin += count[b++])
+                {
+                    if (count[b] < 2)
+                        continue;
+                    Entry* bucket = a + begin;
+                    Entry* spare = tmp + begin;
+                    if (shift > 0)
+                        Radix(bucket, spare, count[b], depth, shift - 8, level + 1);
+                    else
+                    {
+                        const size_t rest = Next(bucket, spare, count[b], depth);
+                        Radix(bucket, spare, rest, depth + 8, 56, level + 1);
+                    }
+                }
+                return;
+            }
+            n = Next(a, tmp, n, depth);
+            depth += 8;
+            shift = 56;
+        }
+    }
+    /** the prefixes of the n entries are equal, moves on to the next 8 bytes
+     *
+     * The keys, which ended, are moved to the front, shorter first, the
+     * entries after them get their next prefix. a is set to the first of
+     * them, returns their number.
+     */
+    size_t Next(Entry*& a, Entry*& tmp, size_t n, size_t depth)const
+    {   // the ended keys are put to the front of tmp, the rest to its back, in reverse
+        const size_t from = depth + 8;
+        size_t ended = 0, rest = n;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (key(*a[i].item).second <= from)
+                tmp[ended++] = a[i];
+            else
+            {
+                tmp[--rest] = a[i];
+                tmp[rest].prefix = Prefix(*a[i].item, from);
+            }
+        }
+        std::copy(tmp, tmp + ended, a);
+        std::reverse_copy(tmp + ended, tmp + n, a + ended);
+        if (ended > 1)
+        {
+            std::stable_sort(a, a + ended, [&](const Entry& x, const Entry& y)
+            {
+                return key(*x.item).second < key(*y.item).second;
+            });
+        }
+        a += ended;
+        tmp += ended;
+        return n - ended;
+    }
+    //! moves the records into the order of the entries
+    void Permute(T* begin)
+    {   // gathering is faster than following the cycles, the loads are independent
+        sorted.clear();
+        for (const auto& entry : entries)
+            sorted.push_back(std::move(*entry.item));
+        std::move(sorted.begin(), sorted.end(), begin);
+    }
+
+    Key key;
+    // kept for the next Sort
+    std::vector<Entry> entries, buffer;
+    std::vector<T> sorted;
+};
+
+//! sorts the records by key(record), see StringSorter
+template<typename T, typename Key>
+void StringSort(T* begin, T* end, Key key)
+{
+    StringSorter<T, Key>(key).Sort(begin, end);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+
+/** byte-class table and vectorized scanners for text-mode separators
+ *
+ * The separator set is compiled once (in SetSeparator) into a 256-entry
+ * table and, if it is small enough, a list of bytes for the SSE2/AVX2
+ * kernels. The kernel is selected at runtime according to the CPU.
+ * Note that '\0' is always a separator, just like in strchr(separators, c).
+ */
+struct Tokenizer
+{
+    enum Engine
+    {
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+
+    typedef const char* (*Scanner)(const char* begin, const char* end);
+
+    //! compiles the separator set and selects the fastest available kernel
+    static void SetSeparators(const char* separators);
+    //! forces a given kernel, returns false if it is not supported
+    static bool SetEngine(Engine engine);
+    static Engine GetEngine() { return engine; }
+    static const char* GetEngineName(Engine engine);
+    static bool IsSupported(Engine engine);
+
+    static inline bool IsSeparator(char c) noexcept
+    {
+        return table[(unsigned char)c];
+    }
+    //! returns the first separator in [begin, end) or end if there is none
+    static inline const char* FindSeparator(const char* begin, const char* end) noexcept
+    {
+        return scanner(begin, end);
+    }
+
+    static constexpr size_t max_vector_separators = 8;
+
+    static bool table[256];
+    static unsigned char vector_separators[max_vector_separators];
+    static size_t vector_separators_size; //!< 0 if the set is too large for the vector kernels
+private:
+    static Scanner scanner;
+    static Engine engine;
+};
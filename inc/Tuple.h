@@ -3,8 +3,11 @@
 #include <cstring>
 #include <cwchar>
 #include <string>
+#include <algorithm>
 
 #include "DataTypes.h"
+#include "RunFormat.h"
+#include "StringSort.h"
 #include "Utils.h"
 
 enum FormatType
@@ -130,51 +133,195 @@ struct TupleView<true> : DataView<true>
     }
 };
 
-bool ParseText(const char* str, std::vector<char>& parsed) noexcept;
+/** a step of the compiled text format, see ParseText
+ *
+ * The format is compiled once in InitParse, every conversion of it
+ * becomes an op with its field (offset in parsed), the rare conversions
+ * are left to sscanf.
+ */
+struct ParseOp
+{
+    enum Code
+    {
+        SPACE, //!< white-space in the format, skips any number of them
+        LITERAL, //!< the character c (and %%)
+        INTEGER, //!< %d %i %u %o %x
+        FLOAT, //!< %f %e %g
+        STRING, //!< %s, the start is stored
+        SET, //!< %[...], the start is stored
+        CHAR, //!< %c
+        COUNT, //!< %n
+        SCANF, //!< anything else, sscanf with the conversion in spec
+    };
+    Code code;
+    FormatType type;
+    char c;
+    int base; //!< of INTEGER, 0 like %i
+    size_t width; //!< 0 if not limited
+    size_t offset; //!< in parsed, npos if the field is skipped
+    std::vector<char> set; //!< 256 flags of SET
+    std::string spec; //!< the conversion for sscanf, ends with %n
+
+    static const size_t npos = (size_t)-1;
+};
+
+/** parses a line by the compiled format into parsed (parsed_size bytes)
+ *
+ * Returns true if every field is read, the same as sscanf with the
+ * patched format would do (the number of the fields read is compared like
+ * its return value). The numbers are read by fast routines where their
+ * value is exact, otherwise by sscanf itself.
+ * There is no limit on the number of fields.
+ */
+bool ParseText(const char* str, char* parsed) noexcept;
 
 template<>
 struct TupleView<false> : DataView<false>
 {
     static std::vector<size_t> offsets;
-    Buffer parsed; //!< parsed is a binary format array
+    Buffer parsed; //!< parsed is a binary format array, followed by the normalized key (see Normalize)
 
     TupleView(): parsed(parsed_size) {}
 
     static bool InitParse(const char* format, const std::vector<int>& keys);
 
     static int non_str_field_number;
-    static std::string patched_format;
+    static std::string patched_format; //!< for sscanf, the strings are replaced by their offset (%zn)
+    static std::vector<ParseOp> program; //!< the format compiled for ParseText
     static std::vector<Comparer> comps;
     static std::vector<ParseResult> types;
     static std::vector<size_t> keys;
+    static std::vector<bool> reversed; //!< of the keys
     static size_t parsed_size; //!< size of parsed
+    static bool normalized; //!< the keys are compared by key, otherwise by comps
 
     bool ReadFrom(char*& buffer, char* end) noexcept;
+    //! parses the line at ptr and normalizes its key, false if the line does not match the format
+    bool ParseLine() noexcept;
+    /** appends the keys of the line to key, encoded so that memcmp of the keys gives the order
+     *
+     * The fields of the line are at fields.data() + at, they may be in key.
+     * The integers are big-endian with the sign bit flipped, the floating
+     * point numbers are their bits with the sign bit flipped (all the bits
+     * if they are negative), the strings end with a 0 byte (they have no
+     * other one). A reversed key has all its bytes inverted.
+     * Wide strings and long doubles cannot be normalized, with them the
+     * comparers are used (normalized is false).
+     */
+    static void Normalize(const char* line, const Buffer& fields, size_t at, Buffer& key);
+    //! compares two lines by the comparers, from their parsed fields
+    static bool Less(const char* a, const char* fields_a, const char* b, const char* fields_b);
+    const char* key()const
+    {
+        return parsed.data() + parsed_size;
+    }
+    size_t key_size()const
+    {
+        return parsed.size() - parsed_size;
+    }
     bool operator<(const TupleView& other)const
     {
-        for (size_t i = 0; i < keys.size(); ++i)
+        if (normalized)
         {
-            const char *a, *b;
-            const auto& k = keys[i];
-            const auto& comparer = comps[i];
+            const int c = memcmp(key(), other.key(), std::min(key_size(), other.key_size()));
+            return c < 0 || (c == 0 && key_size() < other.key_size());
+        }
+        return Less(ptr, parsed.data(), other.ptr, other.parsed.data());
+    }
+};
 
-            if (types[k].type == SCANF_STRING || types[k].type == SCANF_WSTRING)
-            {
-                a = ptr + *(size_t*)(parsed.data() + offsets[k]);
-                b = other.ptr + *(size_t*)(other.parsed.data() + offsets[k]);
-            }
-            else
-            {
-                a = parsed.data() + offsets[k];
-                b = other.parsed.data() + offsets[k];
-            }
-            switch (comparer(a, b))
-            {
-            case -1: return true;
-            case  1: return false;
-            default: continue;
-            }
-        };
-        return false;
+/** the lines of a run of esort in text mode, without an allocation per line
+ *
+ * The lines stay in the input buffer, their parsed fields are stored one
+ * after the other in fields (parsed_size bytes each) and their normalized
+ * keys in keys, or the key is the line itself, if it is a single string.
+ * The line of the i-th fields is lines[i] until the sort, which moves only
+ * the (pointer, size) views of the lines (and the (key prefix, view)
+ * entries of StringSorter). The buffers are kept for the next run, so the
+ * lines are read without allocation, once they are large enough.
+ */
+class TupleBatch
+{
+public:
+    TupleBatch();
+    TupleBatch(const TupleBatch&) = delete;
+    TupleBatch& operator=(const TupleBatch&) = delete;
+
+    /** parses the complete lines of [begin, end), leaves begin after them
+     *
+     * The lines, which do not match the format, are dropped.
+     */
+    void Read(char*& begin, char* end);
+    /** sorts the lines, equal keys keep their order
+     *
+     * With more threads, the lines are sorted by ParallelSampleSort, the
+     * order is the same for any number of threads.
+     */
+    std::pair<const DataView<false>*, const DataView<false>*> Sort(size_t threads = 1);
+    void Clear();
+    //! the bytes allocated
+    size_t GetAllocated()const;
+
+private:
+    //! the normalized key of the i-th line read
+    std::pair<const char*, size_t> Key(size_t i)const;
+    //! the i-th line read is before the j-th one, ties are broken by the place
+    bool Before(size_t i, size_t j)const;
+
+    //! the normalized key of a line, by its place in lines
+    struct LineKey
+    {
+        const TupleBatch* batch;
+        std::pair<const char*, size_t> operator()(const DataView<false>& line)const
+        {
+            return batch->Key(&line - batch->lines.data());
+        }
+    };
+    //! the normalized key of a line, by its index
+    struct IndexKey
+    {
+        const TupleBatch* batch;
+        std::pair<const char*, size_t> operator()(size_t i)const
+        {
+            return batch->Key(i);
+        }
+    };
+    std::vector<DataView<false>> lines, sorted;
+    Buffer fields, keys;
+    std::vector<size_t> key_ends; //!< of the lines in keys
+    std::vector<size_t> indices, order; //!< of the lines, if they are not sorted in place
+    StringSorter<DataView<false>, LineKey> sorter;
+    std::vector<StringSorter<size_t, IndexKey>> bucket_sorters; //!< one for each thread
+    bool key_is_line; //!< the key is a single string, it is not copied
+};
+
+/** sorts a run of binary records, they are compared by the comparers
+ *
+ * Equal records keep their order. With more threads, the run is sorted by
+ * ParallelSampleSort, the order is the same for any number of threads.
+ */
+void SortRun(TupleView<true>* begin, TupleView<true>* end, size_t threads = 1);
+
+template<>
+bool Packet<TupleView<true>>::ReadFrom(BlockReader& reader);
+template<>
+bool Packet<TupleView<false>>::ReadFrom(BlockReader& reader);
+//! from a front coded run, the lines are parsed again
+template<>
+bool Packet<TupleView<false>>::ReadFrom(RunReader& run);
+
+/** the sorted text runs of esort are front coded, without counts
+ *
+ * The lines of a run often share a prefix, see RunFormat.h.
+ */
+size_t DumpRun(const DataView<false>* begin, const DataView<false>* end, const std::string& filename, bool compress);
+
+//! reads the front coded runs and the human readable files (-m)
+template<>
+struct FileReader<Packet<TupleView<false>>> : RunFileReader<Packet<TupleView<false>>>
+{
+    FileReader(const std::string& fname, bool del, size_t block_size = 1 << 16)
+        : RunFileReader(fname, del, block_size)
+    {
     }
 };
@@ -2,6 +2,12 @@
 
 #include <initializer_list>
 #include <string>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _MSC_VER
+#   include <intrin.h>
+#endif
 
 bool SetBinaryIO();
 
@@ -9,6 +15,12 @@ bool matches(const char* str, const std::initializer_list<const char*>& patterns
 
 std::string GetFilename(size_t i, int width = 3, const char* prefix = "");
 
+//! size of the file in bytes, 0 if it cannot be opened
+size_t GetFileSize(const std::string& filename);
+
+//! the number of files the process can have open at once
+size_t MaxOpenFiles();
+
 //! https://stackoverflow.com/questions/1903954/is-there-a-standard-sign-function-signum-sgn-in-c-c
 template <typename T>
 inline int sgn(T val)
@@ -22,6 +34,50 @@ inline int cmp(T val1, T val2)
     return (val2 < val1) - (val1 < val2);
 }
 
+//! index of the lowest set bit, x should not be 0
+inline unsigned int CountTrailingZeros(uint32_t x)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (unsigned int)i;
+#else
+    return (unsigned int)__builtin_ctz(x);
+#endif
+}
+
+/** writes v in decimal to out, returns the number of digits
+ *
+ * out has room for 20 digits. Two digits at a time from a table, no locale.
+ */
+inline size_t FormatDecimal(uint64_t v, char* out)
+{
+    static const char pairs[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    while (v >= 100)
+    {
+        p -= 2;
+        memcpy(p, pairs + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if (v >= 10)
+    {
+        p -= 2;
+        memcpy(p, pairs + v * 2, 2);
+    }
+    else
+        *--p = (char)('0' + v);
+    const size_t n = digits + sizeof(digits) - p;
+    memcpy(out, p, n);
+    return n;
+}
+
 struct Fnv1a
 {	// struct for generating FNV-1a hashes
     static constexpr size_t prime = sizeof(size_t) == 8 ? 1099511628211U : 16777619U;
@@ -31,6 +87,28 @@ struct Fnv1a
     size_t operator()(const char * ptr, size_t size)const;
 };
 
+//! https://github.com/wangyi-fudan/wyhash
+struct WyHash
+{	// struct for generating hashes 8 bytes at a time
+    static size_t hash(const char * ptr, size_t size);
+    size_t operator()(const char * ptr, size_t size)const;
+};
+
+//! the hash function of the hash tables, selectable at runtime
+struct KeyHash
+{
+    typedef size_t(*Function)(const char*, size_t);
+
+    static inline size_t hash(const char * ptr, size_t size)
+    {
+        return function(ptr, size);
+    }
+    //! "wyhash" or "fnv1a", returns false for an unknown name
+    static bool Set(const char* name);
+
+    static Function function;
+};
+
 template<typename Type = size_t>
 bool blockedmemeq(const void* a, const void* b, size_t size)
 {
@@ -0,0 +1,450 @@
+#include "AsyncIo.h"
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#   define ASYNCIO_POSIX
+#   include <sys/stat.h>
+#   include <sys/uio.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <cerrno>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#   if __has_include(<linux/io_uring.h>)
+#       define ASYNCIO_URING
+#       include <linux/io_uring.h>
+#       include <sys/mman.h>
+#       include <sys/syscall.h>
+#   endif
+#endif
+#if defined(ASYNCIO_URING) && !(defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter))
+#   undef ASYNCIO_URING
+#endif
+
+namespace {
+
+IoBackend backend_used = IoBackend::sync;
+bool direct_used = false;
+
+//! the alignment of O_DIRECT offsets, sizes and buffers
+const size_t alignment = 4096;
+
+char* Align(char* p)
+{
+    return p + (alignment - (uintptr_t)p % alignment) % alignment;
+}
+
+//! turns O_DIRECT on or off, false if the file system does not support it
+bool SetDirect(int fd, bool direct)
+{
+#if defined(ASYNCIO_POSIX) && defined(O_DIRECT)
+    const int flags = fcntl(fd, F_GETFL);
+    return flags != -1 && fcntl(fd, F_SETFL, direct ? (flags | O_DIRECT) : (flags & ~O_DIRECT)) != -1;
+#else
+    (void)fd;
+    return !direct;
+#endif
+}
+
+//! the whole request, on the calling thread
+long long Transfer(bool write, int fd, char* buffer, size_t size, uint64_t offset)
+{
+#ifdef ASYNCIO_POSIX
+    size_t done = 0;
+    while (done < size)
+    {
+        const ssize_t n = write ? pwrite(fd, buffer + done, size - done, (off_t)(offset + done)) :
+            pread(fd, buffer + done, size - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -errno;
+        if (n == 0)
+            break;
+        done += (size_t)n;
+    }
+    return (long long)done;
+#else
+    (void)write; (void)fd; (void)buffer; (void)size; (void)offset;
+    return -1;
+#endif
+}
+
+}
+
+#ifdef ASYNCIO_URING
+//! the rings shared with the kernel, readv and writev requests only (Linux 5.1)
+struct IoQueue::Ring
+{
+    explicit Ring(unsigned entries)
+        : fd(-1), sq(MAP_FAILED), cq(MAP_FAILED), sqes(MAP_FAILED), sq_size(0), cq_size(0), sqes_size(0)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0)
+            return;
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        sq = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED)
+            return;
+        cq = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq :
+            mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            return;
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return;
+        char* const s = (char*)sq;
+        sq_tail = (unsigned*)(s + params.sq_off.tail);
+        sq_mask = *(unsigned*)(s + params.sq_off.ring_mask);
+        sq_array = (unsigned*)(s + params.sq_off.array);
+        char* const c = (char*)cq;
+        cq_head = (unsigned*)(c + params.cq_off.head);
+        cq_tail = (unsigned*)(c + params.cq_off.tail);
+        cq_mask = *(unsigned*)(c + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(c + params.cq_off.cqes);
+        iovecs.resize(entries);
+    }
+    ~Ring()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_size);
+        if (cq != MAP_FAILED && cq != sq)
+            munmap(cq, cq_size);
+        if (sq != MAP_FAILED)
+            munmap(sq, sq_size);
+        if (fd >= 0)
+            close(fd);
+    }
+    bool Ready()const
+    {
+        return sqes != MAP_FAILED;
+    }
+    bool Submit(size_t slot, bool write, int file, char* buffer, size_t size, uint64_t offset)
+    {
+        iovecs[slot].iov_base = buffer;
+        iovecs[slot].iov_len = size;
+        const unsigned tail = *sq_tail;
+        const unsigned index = tail & sq_mask;
+        io_uring_sqe& sqe = ((io_uring_sqe*)sqes)[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe.fd = file;
+        sqe.addr = (uint64_t)(uintptr_t)&iovecs[slot];
+        sqe.len = 1;
+        sqe.off = offset;
+        sqe.user_data = slot;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        long result;
+        while ((result = syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0)) < 0 && (errno == EINTR || errno == EAGAIN))
+            ;
+        if (result != 1)
+        {   // not taken by the kernel, the caller does it itself
+            __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+            return false;
+        }
+        return true;
+    }
+    //! waits for a completion
+    void Reap(size_t& slot, long long& result)
+    {
+        unsigned head = *cq_head;
+        while (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        const io_uring_cqe& cqe = cqes[head & cq_mask];
+        slot = (size_t)cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    }
+
+    int fd;
+    void *sq, *cq, *sqes;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned *sq_tail, *sq_array, *cq_head, *cq_tail;
+    unsigned sq_mask, cq_mask;
+    io_uring_cqe* cqes;
+    std::vector<iovec> iovecs; //!< one for each slot
+};
+#else
+struct IoQueue::Ring
+{
+    explicit Ring(unsigned)
+    {
+    }
+    bool Ready()const
+    {
+        return false;
+    }
+    bool Submit(size_t, bool, int, char*, size_t, uint64_t)
+    {
+        return false;
+    }
+    void Reap(size_t&, long long&)
+    {
+    }
+};
+#endif
+
+IoBackend SetAsyncIo(IoBackend backend, bool direct)
+{
+    if (backend == IoBackend::uring && !IoQueue::RingAvailable())
+        backend = IoBackend::threads;
+#ifndef ASYNCIO_POSIX
+    backend = IoBackend::sync;
+#endif
+    backend_used = backend;
+    direct_used = direct && backend != IoBackend::sync;
+    return backend;
+}
+
+IoBackend AsyncIoBackend()
+{
+    return backend_used;
+}
+
+bool AsyncIoDirect()
+{
+    return direct_used;
+}
+
+const char* IoBackendName(IoBackend backend)
+{
+    switch (backend)
+    {
+    case IoBackend::uring: return "uring";
+    case IoBackend::threads: return "threads";
+    default: return "sync";
+    }
+}
+
+bool ParseIoBackend(const char* name, IoBackend& backend)
+{
+    for (const auto b : { IoBackend::sync, IoBackend::uring, IoBackend::threads })
+    {
+        if (strcmp(name, IoBackendName(b)) == 0)
+        {
+            backend = b;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool UseAsyncIo(FILE* f)
+{
+#ifdef ASYNCIO_POSIX
+    struct stat st;
+    return backend_used != IoBackend::sync && f != nullptr && f != stdin && f != stdout &&
+        fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode);
+#else
+    (void)f;
+    return false;
+#endif
+}
+
+IoQueue::IoQueue(size_t depth)
+    : busy(depth, 0), reaped(depth, 0), results(depth, 0), threads(depth)
+{
+    if (backend_used == IoBackend::uring)
+    {
+        ring.reset(new Ring((unsigned)depth));
+        if (!ring->Ready())
+            ring.reset();
+    }
+}
+
+bool IoQueue::RingAvailable()
+{
+    return Ring(1).Ready();
+}
+
+IoQueue::~IoQueue()
+{
+    // the buffers are not released before the requests are done
+    for (size_t slot = 0; slot < busy.size(); ++slot)
+        Complete(slot);
+}
+
+void IoQueue::Read(size_t slot, int fd, char* buffer, size_t size, uint64_t offset)
+{
+    Submit(slot, false, fd, buffer, size, offset);
+}
+
+void IoQueue::Write(size_t slot, int fd, const char* buffer, size_t size, uint64_t offset)
+{
+    Submit(slot, true, fd, (char*)buffer, size, offset);
+}
+
+void IoQueue::Submit(size_t slot, bool write, int fd, char* buffer, size_t size, uint64_t offset)
+{
+    busy[slot] = 1;
+    if (ring)
+    {
+        if (!ring->Submit(slot, write, fd, buffer, size, offset))
+        {   // done right here
+            results[slot] = Transfer(write, fd, buffer, size, offset);
+            reaped[slot] = 1;
+        }
+    }
+    else
+        threads[slot] = std::async(std::launch::async, Transfer, write, fd, buffer, size, offset);
+}
+
+long long IoQueue::Complete(size_t slot)
+{
+    if (!busy[slot])
+        return results[slot];
+    if (ring)
+    {   // the others completed meanwhile are kept for their turn
+        while (!reaped[slot])
+        {
+            size_t done;
+            long long result;
+            ring->Reap(done, result);
+            results[done] = result;
+            reaped[done] = 1;
+        }
+        reaped[slot] = 0;
+    }
+    else
+        results[slot] = threads[slot].get();
+    busy[slot] = 0;
+    return results[slot];
+}
+
+AsyncReader::AsyncReader(int fd, uint64_t offset, size_t chunk_size, bool direct)
+    : queue(async_io_depth), fd(fd), chunk_size(std::max(alignment, chunk_size / alignment * alignment)),
+    storage(new char[async_io_depth * this->chunk_size + alignment]), sizes(async_io_depth, 0),
+    current(0), pos(0), next(offset), done(false)
+{
+    chunks = Align(storage.get());
+    if (direct && SetDirect(fd, true))
+    {   // the first chunk starts before offset
+        next = offset / alignment * alignment;
+        pos = (size_t)(offset - next);
+    }
+    for (size_t slot = 0; slot < async_io_depth; ++slot)
+        Submit(slot);
+}
+
+void AsyncReader::Submit(size_t slot)
+{
+    queue.Read(slot, fd, chunks + slot * chunk_size, chunk_size, next);
+    next += chunk_size;
+}
+
+size_t AsyncReader::Read(char* out, size_t size)
+{
+    size_t result = 0;
+    while (result < size)
+    {
+        if (queue.Busy(current))
+        {
+            const long long n = queue.Complete(current);
+            sizes[current] = n > 0 ? (size_t)n : 0;
+        }
+        if (pos < sizes[current])
+        {
+            const size_t n = std::min(size - result, sizes[current] - pos);
+            memcpy(out + result, chunks + current * chunk_size + pos, n);
+            pos += n;
+            result += n;
+            continue;
+        }
+        // the end of the file is in a short chunk
+        if (done || sizes[current] < chunk_size)
+        {
+            done = true;
+            break;
+        }
+        Submit(current);
+        current = (current + 1) % async_io_depth;
+        pos = 0;
+    }
+    return result;
+}
+
+AsyncWriter::AsyncWriter(int fd, uint64_t offset, size_t chunk_size, bool direct)
+    : queue(async_io_depth), fd(fd), chunk_size(std::max(alignment, chunk_size / alignment * alignment)),
+    storage(new char[async_io_depth * this->chunk_size + alignment]), sizes(async_io_depth, 0),
+    offsets(async_io_depth, 0), current(0), used(0), offset(offset), direct(false), failed(false)
+{
+    chunks = Align(storage.get());
+    this->direct = direct && offset % alignment == 0 && SetDirect(fd, true);
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    for (size_t slot = 0; slot < async_io_depth; ++slot)
+        Wait(slot);
+}
+
+bool AsyncWriter::Write(const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        const size_t n = std::min(size, chunk_size - used);
+        memcpy(chunks + current * chunk_size + used, data, n);
+        used += n;
+        data += n;
+        size -= n;
+        if (used == chunk_size)
+            Submit();
+    }
+    return !failed;
+}
+
+bool AsyncWriter::Flush()
+{
+    if (used > 0 && direct)
+    {   // the partial chunk cannot be written with O_DIRECT
+        for (size_t slot = 0; slot < async_io_depth; ++slot)
+            Wait(slot);
+        direct = false;
+        failed = !SetDirect(fd, false) || failed;
+    }
+    if (used > 0)
+        Submit();
+    for (size_t slot = 0; slot < async_io_depth; ++slot)
+        Wait(slot);
+    return !failed;
+}
+
+void AsyncWriter::Submit()
+{
+    sizes[current] = used;
+    offsets[current] = offset;
+    queue.Write(current, fd, chunks + current * chunk_size, used, offset);
+    offset += used;
+    used = 0;
+    current = (current + 1) % async_io_depth;
+    Wait(current);
+}
+
+void AsyncWriter::Wait(size_t slot)
+{
+    if (!queue.Busy(slot))
+        return;
+    const long long n = queue.Complete(slot);
+    if (n >= 0 && (size_t)n < sizes[slot])
+    {   // the rest of a short write, without O_DIRECT
+        const size_t rest = sizes[slot] - (size_t)n;
+        if (direct)
+        {
+            direct = false;
+            SetDirect(fd, false);
+        }
+        failed = Transfer(true, fd, chunks + slot * chunk_size + n, rest, offsets[slot] + n) != (long long)rest || failed;
+    }
+    else if (n < 0)
+        failed = true;
+}
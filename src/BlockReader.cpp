@@ -0,0 +1,131 @@
+#include "BlockReader.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#   define BLOCKREADER_MMAP
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+BlockReader::BlockReader(BlockReader&& other)
+    : f(other.f), block_size(other.block_size), storage(std::move(other.storage)),
+    block(other.block), current(other.current), pos(other.pos), end(other.end), switched(other.switched),
+    mapping(other.mapping), mapped(other.mapped), released(other.released), last(other.last),
+    compressed(other.compressed), packed(std::move(other.packed)), pending(other.pending),
+    input(std::move(other.input))
+{
+    memcpy(head, other.head, pending);
+    other.f = nullptr;
+    other.block = other.mapping = nullptr;
+    other.pos = other.end = other.mapped = other.pending = 0;
+}
+
+BlockReader::~BlockReader()
+{
+#ifdef BLOCKREADER_MMAP
+    if (mapping)
+        munmap(mapping, mapped);
+#endif
+}
+
+void BlockReader::Open()
+{
+    if (f)
+    {
+        pending = fread(head, 1, sizeof(head), f);
+        if (pending == sizeof(lz_magic) && memcmp(head, lz_magic, sizeof(lz_magic)) == 0)
+        {
+            compressed = true;
+            pending = 0;
+            block_size = std::max(block_size, lz_frame_size);
+        }
+        else if (pending > 0 && fseek(f, -(long)pending, SEEK_CUR) == 0)
+        {
+            pending = 0;
+            if (!UseAsyncIo(f) && Map())
+                return;
+        }
+        const long offset = ftell(f);
+        if (pending == 0 && offset >= 0 && UseAsyncIo(f))
+            input.reset(new AsyncReader(fileno(f), (uint64_t)offset, block_size, AsyncIoDirect()));
+    }
+    storage.reset(new char[2 * block_size + alignment]);
+}
+
+size_t BlockReader::Unpack(char* out)
+{
+    LzFrame frame;
+    if (ReadFile((char*)&frame, sizeof(frame)) != sizeof(frame))
+        return 0;
+    bool success = frame.size <= block_size && frame.packed <= LzBound(frame.size);
+    if (success && frame.packed == frame.size)
+        success = ReadFile(out, frame.size) == frame.size;
+    else if (success)
+    {
+        packed.resize(frame.packed);
+        success = ReadFile(packed.data(), frame.packed) == frame.packed &&
+            LzDecompress(packed.data(), frame.packed, out, frame.size);
+    }
+    if (!success)
+    {
+        fprintf(stderr, "Corrupt compressed file!\n");
+        return 0;
+    }
+    return frame.size;
+}
+
+bool ScanFrames(const std::string& filename, size_t& size, size_t& records)
+{
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (f == NULL)
+        return false;
+    // a pipe can be read only once, by the merge
+    char magic[sizeof(lz_magic)];
+    const bool result = fseek(f, 0, SEEK_END) == 0 && fseek(f, 0, SEEK_SET) == 0 &&
+        fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, lz_magic, sizeof(magic)) == 0;
+    size = records = 0;
+    LzFrame frame;
+    while (result && fread(&frame, sizeof(frame), 1, f) == 1 && fseek(f, (long)frame.packed, SEEK_CUR) == 0)
+    {
+        size += frame.size;
+        records += frame.records;
+    }
+    fclose(f);
+    return result;
+}
+
+bool BlockReader::Map()
+{
+#ifdef BLOCKREADER_MMAP
+    struct stat st;
+    if (f == nullptr || fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+        return false;
+    const long offset = ftell(f);
+    if (offset < 0 || offset > st.st_size)
+        return false;
+    void* result = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+    if (result == MAP_FAILED)
+        return false;
+    madvise(result, (size_t)st.st_size, MADV_SEQUENTIAL);
+    mapping = block = (char*)result;
+    mapped = end = (size_t)st.st_size;
+    released = 0;
+    pos = last = (size_t)offset;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void BlockReader::Release()
+{
+#ifdef BLOCKREADER_MMAP
+    static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t until = last / page * page;
+    if (until > released)
+    {
+        madvise(mapping + released, until - released, MADV_DONTNEED);
+        released = until;
+    }
+#endif
+}
@@ -0,0 +1,138 @@
+#include "BlockWriter.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#   define BLOCKWRITER_WRITEV
+#   include <sys/uio.h>
+#   include <unistd.h>
+#   include <cerrno>
+#endif
+
+namespace {
+
+//! writes all the pieces after each other
+bool WritePieces(FILE* f, AsyncWriter* output, const char* const* data, const size_t* sizes, size_t n)
+{
+    if (output)
+    {
+        bool result = true;
+        for (size_t i = 0; i < n; ++i)
+            result = output->Write(data[i], sizes[i]) && result;
+        return result;
+    }
+#ifdef BLOCKWRITER_WRITEV
+    iovec pieces[4];
+    for (size_t i = 0; i < n; ++i)
+    {
+        pieces[i].iov_base = (void*)data[i];
+        pieces[i].iov_len = sizes[i];
+    }
+    iovec* piece = pieces;
+    const int fd = fileno(f);
+    while (n > 0)
+    {
+        const ssize_t written = writev(fd, piece, (int)n);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        // skips the pieces written, continues the one written partially
+        size_t done = (size_t)written;
+        while (n > 0 && done >= piece->iov_len)
+        {
+            done -= piece->iov_len;
+            ++piece;
+            --n;
+        }
+        if (n > 0)
+        {
+            piece->iov_base = (char*)piece->iov_base + done;
+            piece->iov_len -= done;
+        }
+    }
+    return true;
+#else
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (sizes[i] > 0 && fwrite(data[i], sizes[i], 1, f) != 1)
+            return false;
+    }
+    return true;
+#endif
+}
+
+}
+
+BlockWriter::BlockWriter(FILE* f, bool compress, size_t block_size, bool background)
+    : f(f), block(compress ? lz_frame_size : block_size), used(0), records(0),
+    compress(compress), started(false), background(background), failed(false)
+{
+#ifdef BLOCKWRITER_WRITEV
+    // whatever is in the buffer of the FILE comes first
+    if (f)
+        fflush(f);
+#endif
+    if (background)
+        spare.resize(block.size());
+    if (UseAsyncIo(f))
+    {   // chunks of the block size, a partition writer of the grace mode is one of many
+        const long offset = ftell(f);
+        if (offset >= 0)
+            output.reset(new AsyncWriter(fileno(f), (uint64_t)offset, block.size(), AsyncIoDirect()));
+    }
+}
+
+BlockWriter::~BlockWriter()
+{
+    if (writing.valid())
+        writing.get();
+}
+
+bool BlockWriter::Flush()
+{
+    bool result = Pass();
+    if (writing.valid())
+        result = writing.get() && result;
+    if (output)
+        result = output->Flush() && result;
+    return result && !failed;
+}
+
+bool BlockWriter::Pass()
+{
+    if (used == 0)
+        return !failed;
+    const uint32_t block_records = records;
+    const size_t size = used;
+    used = 0;
+    records = 0;
+    if (!background)
+        return WriteBlock(block.data(), size, block_records) && !failed;
+    // the previous block is written by now, its buffer is filled next
+    if (writing.valid() && !writing.get())
+        failed = true;
+    std::swap(block, spare);
+    writing = std::async(std::launch::async, [this, size, block_records]()
+    {
+        return WriteBlock(spare.data(), size, block_records);
+    });
+    return !failed;
+}
+
+bool BlockWriter::WriteBlock(const char* data, size_t size, uint32_t block_records)
+{
+    if (!compress)
+        return WritePieces(f, output.get(), &data, &size, 1);
+    packed.resize(LzBound(size));
+    size_t packed_size = LzCompress(data, size, packed.data(), packed.size());
+    const bool stored = packed_size == 0 || packed_size >= size;
+    if (stored)
+        packed_size = size;
+    const LzFrame frame = { (uint32_t)size, (uint32_t)packed_size, block_records };
+    // the magic goes before the first frame
+    const char* pieces[] = { lz_magic, (const char*)&frame, stored ? data : packed.data() };
+    const size_t sizes[] = { started ? 0 : sizeof(lz_magic), sizeof(frame), packed_size };
+    started = true;
+    return WritePieces(f, output.get(), pieces, sizes, 3);
+}
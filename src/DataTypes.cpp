@@ -1,6 +1,9 @@
 #include "DataTypes.h"
 
 #include "Utils.h"
+#include "Tokenizer.h"
+#include "BlockReader.h"
+#include "RunFormat.h"
 
 #include <cstring>
 #include <cstdlib>
@@ -46,12 +49,20 @@ const char* DataView<false>::separators = "";
 //}
 
 template<>
-bool Packet<DataView<true>>::ReadFrom(FILE* f)
+bool Packet<DataView<true>>::ReadFrom(BlockReader& reader)
 {
-    resize(view.size);
-    if (fread(data(), view.size, 1, f))
+    view.ptr = reader.Take(view.size, *this);
+    return view.ptr != nullptr;
+}
+
+template<>
+bool Packet<RecordView<true>>::ReadFrom(BlockReader& reader)
+{
+    const char* p = reader.Take(view.size + sizeof(view.count), *this);
+    if (p)
     {
-        view.ptr = data();
+        memcpy(&view.count, p + view.size, sizeof(view.count));
+        view.ptr = p;
         return true;
     }
     else
@@ -59,13 +70,15 @@ bool Packet<DataView<true>>::ReadFrom(FILE* f)
 }
 
 template<>
-bool Packet<RecordView<true>>::ReadFrom(FILE* f)
+bool Packet<DataView<false>>::ReadFrom(BlockReader& reader)
 {
-    resize(view.size);
-    if (fread(data(), view.size, 1, f) == 1 &&
-        fread(&view.count, sizeof(view.count), 1, f) == 1)
+    size_t size;
+    char* p = reader.Until(view.separators[0], size, *this);
+    if (p)
     {
-        view.ptr = data();
+        p[size] = '\0';
+        view.size = size + 1;
+        view.ptr = p;
         return true;
     }
     else
@@ -73,41 +86,40 @@ bool Packet<RecordView<true>>::ReadFrom(FILE* f)
 }
 
 template<>
-bool Packet<DataView<false>>::ReadFrom(FILE* f)
+bool Packet<RecordView<false>>::ReadFrom(BlockReader& reader)
 {
-    clear();
-    int c;
-    while ((c = fgetc(f)) != EOF && (char)c != view.separators[0])
+    size_t size;
+    char* p = reader.Until('\n', size, *this);
+    if (p == nullptr)
+        return false;
+    p[size] = '\0';
+    // the count is after the last separator
+    size_t sep = size;
+    while (sep > 0 && p[sep - 1] != view.separator)
+        --sep;
+    if (sep > 0)
     {
-        emplace_back((char)c);
+        p[sep - 1] = '\0';
+        view.count = (size_t)atoll(p + sep);
+        view.size = sep;
+        view.ptr = p;
+        return true;
     }
-    emplace_back('\0');
-    view.size = size();
-    view.ptr = data();
-    return c != EOF || size() > 1;
+    else
+        return false;
 }
 
 template<>
-bool Packet<RecordView<false>>::ReadFrom(FILE* f)
+bool Packet<RecordView<false>>::ReadFrom(RunReader& run)
 {
-    clear();
-    int c;
-    size_t sep = std::string::npos;
-    while ((c = fgetc(f)) != EOF && (char)c != '\n')
-    {
-        emplace_back((char)c);
-        if ((char)c == view.separator)
-            sep = size();
-    }
-    emplace_back('\0');
-
-    if (sep != std::string::npos)
+    char* key;
+    size_t size;
+    uint64_t count;
+    if (run.Next(key, size, count, *this))
     {
-        operator[](sep - 1) = '\0';
-        view.count = (size_t)atoll(data() + sep);
-        resize(sep);
-        view.size = size();
-        view.ptr = data();
+        view.size = size + 1;
+        view.count = (size_t)count;
+        view.ptr = key;
         return true;
     }
     else
@@ -117,6 +129,7 @@ bool Packet<RecordView<false>>::ReadFrom(FILE* f)
 void SetSeparator(const char* sep)
 {
     DataView<false>::separators = sep;
+    Tokenizer::SetSeparators(sep);
     RecordView<false>::separator = (sep[0] == '\n' ? ' ' : sep[0]);
 }
 
@@ -0,0 +1,248 @@
+#include "InputFiles.h"
+
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <memory>
+
+#include "Tokenizer.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#   define INPUTFILES_PREAD
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   include <cerrno>
+#endif
+
+namespace {
+
+const size_t npos = (size_t)-1;
+
+std::unique_ptr<InputFiles> input;
+
+//! size bytes at offset, false on error or if the file is shorter
+bool ReadAt(FILE* f, char* out, size_t size, uint64_t offset)
+{
+#ifdef INPUTFILES_PREAD
+    const int fd = fileno(f);
+    while (size > 0)
+    {
+        const ssize_t n = pread(fd, out, size, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        out += n;
+        size -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+#else
+    (void)f; (void)out; (void)offset;
+    return size == 0;
+#endif
+}
+
+}
+
+InputFiles::InputFiles(const std::vector<std::string>& names, size_t readers, size_t record_size, size_t range_size)
+    : readers(std::max<size_t>(1, readers)), record_size(record_size),
+    range_size(record_size > 0 ? std::max(record_size, range_size / record_size * record_size) : range_size),
+    claimed(0), current(0), pos(0), started(false), stopped(false), failed(false)
+{
+    for (const auto& name : names)
+        files.push_back(File{ name, nullptr, 0, true });
+}
+
+InputFiles::~InputFiles()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    freed.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+    for (auto& file : files)
+    {
+        if (file.f && file.f != stdin)
+            fclose(file.f);
+    }
+}
+
+bool InputFiles::Open()
+{
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        File& file = files[i];
+        file.f = file.name == "-" ? stdin : fopen(file.name.c_str(), "rb");
+        if (file.f == NULL)
+        {
+            std::cerr << "Unable to open \"" << file.name << "\"!" << std::endl;
+            return false;
+        }
+#ifdef INPUTFILES_PREAD
+        struct stat st;
+        if (file.f != stdin && fstat(fileno(file.f), &st) == 0 && S_ISREG(st.st_mode))
+        {
+            file.stream = false;
+            file.size = (uint64_t)st.st_size;
+        }
+#endif
+        if (file.stream)
+            ranges.push_back(Range{ i, 0, 0 });
+        for (uint64_t begin = 0; !file.stream && begin < file.size; begin += range_size)
+            ranges.push_back(Range{ i, begin, std::min<uint64_t>(begin + range_size, file.size) });
+    }
+    slots.resize(2 * readers);
+    for (auto& slot : slots)
+    {
+        slot.range = npos;
+        slot.failed = false;
+    }
+    return true;
+}
+
+bool InputFiles::Boundary(const File& file, uint64_t offset, uint64_t& boundary)const
+{
+    if (offset == 0 || offset >= file.size)
+    {
+        boundary = std::min(offset, file.size);
+        return true;
+    }
+    if (record_size > 0)
+    {
+        boundary = std::min(file.size, (offset + record_size - 1) / record_size * record_size);
+        return true;
+    }
+    // the byte before offset may be the separator itself
+    char buffer[4096];
+    for (uint64_t start = offset - 1; start < file.size; start += sizeof(buffer))
+    {
+        const size_t n = (size_t)std::min<uint64_t>(sizeof(buffer), file.size - start);
+        if (!ReadAt(file.f, buffer, n, start))
+            return false;
+        const char* separator = Tokenizer::FindSeparator(buffer, buffer + n);
+        if (separator < buffer + n)
+        {
+            boundary = start + (separator - buffer) + 1;
+            return true;
+        }
+    }
+    boundary = file.size;
+    return true;
+}
+
+bool InputFiles::Load(const Range& range, std::vector<char>& data)const
+{
+    const File& file = files[range.file];
+    uint64_t begin, end;
+    if (!Boundary(file, range.begin, begin) || !Boundary(file, range.end, end))
+        return false;
+    data.resize((size_t)(end - std::min(begin, end)));
+    return ReadAt(file.f, data.data(), data.size(), begin);
+}
+
+void InputFiles::Reader()
+{
+    while (true)
+    {
+        size_t k;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // the pipes are read by Read
+            while (claimed < ranges.size() && files[ranges[claimed].file].stream)
+                ++claimed;
+            if (claimed >= ranges.size())
+                return;
+            k = claimed++;
+            // the range that used the slot before is consumed
+            freed.wait(lock, [&]() { return stopped || k < current + slots.size(); });
+            if (stopped)
+                return;
+        }
+        Slot& slot = slots[k % slots.size()];
+        const bool success = Load(ranges[k], slot.data);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot.range = k;
+            slot.failed = !success;
+        }
+        loaded.notify_all();
+    }
+}
+
+void InputFiles::Next()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++current;
+    }
+    pos = 0;
+    freed.notify_all();
+}
+
+size_t InputFiles::Read(char* out, size_t size)
+{
+    if (!started)
+    {   // the separators are set by now
+        started = true;
+        for (size_t i = 0; i < readers; ++i)
+            threads.emplace_back(&InputFiles::Reader, this);
+    }
+    size_t result = 0;
+    while (result < size && !failed && current < ranges.size())
+    {
+        const File& file = files[ranges[current].file];
+        if (file.stream)
+        {
+            const size_t n = fread(out + result, 1, size - result, file.f);
+            result += n;
+            if (n == 0 && ferror(file.f))
+            {
+                std::cerr << "Unable to read \"" << file.name << "\"!" << std::endl;
+                failed = true;
+            }
+            else if (n == 0)
+                Next();
+            continue;
+        }
+        const Slot& slot = slots[current % slots.size()];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            loaded.wait(lock, [&]() { return slot.range == current; });
+        }
+        if (slot.failed)
+        {
+            std::cerr << "Unable to read \"" << file.name << "\"!" << std::endl;
+            failed = true;
+            break;
+        }
+        const size_t n = std::min(size - result, slot.data.size() - pos);
+        memcpy(out + result, slot.data.data() + pos, n);
+        pos += n;
+        result += n;
+        if (pos == slot.data.size())
+            Next();
+    }
+    return result;
+}
+
+bool SetInput(const std::vector<std::string>& names, size_t readers, size_t record_size)
+{
+    input.reset();
+    if (names.empty())
+        return true;
+    input.reset(new InputFiles(names, readers, record_size));
+    return input->Open();
+}
+
+size_t ReadInput(char* out, size_t size)
+{
+    return input ? input->Read(out, size) : fread(out, 1, size, stdin);
+}
+
+bool InputFailed()
+{
+    return input && input->Failed();
+}
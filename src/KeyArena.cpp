@@ -0,0 +1,75 @@
+#include "KeyArena.h"
+
+#include <algorithm>
+#include <functional>
+
+KeyArena::KeyArena(size_t slab_size, double max_garbage)
+    : slab_size(std::max<size_t>(1, slab_size)), max_garbage(max_garbage),
+    slabs(), allocated(0), live(0), stats()
+{
+    generations[YOUNG] = generations[OLD] = nullptr;
+}
+
+KeyArena::Slab* KeyArena::Find(const char* ptr)const
+{
+    // last slab starting at or before ptr
+    auto where = std::upper_bound(slabs.begin(), slabs.end(), ptr,
+        [](const char* p, const std::unique_ptr<Slab>& slab)
+        {
+            return std::less<const char*>()(p, slab->data.get());
+        });
+    if (where == slabs.begin())
+        return nullptr;
+    Slab* slab = (--where)->get();
+    return std::less<const char*>()(ptr, slab->data.get() + slab->size) ? slab : nullptr;
+}
+
+const char* KeyArena::Copy(const char* ptr, size_t size, Generation generation)
+{
+    Slab*& current = generations[generation];
+    if (current == nullptr || current->size - current->used < size)
+    {
+        std::unique_ptr<Slab> slab(new Slab(std::max(slab_size, size)));
+        current = slab.get();
+        allocated += slab->size;
+        auto where = std::upper_bound(slabs.begin(), slabs.end(), slab,
+            [](const std::unique_ptr<Slab>& one, const std::unique_ptr<Slab>& other)
+            {
+                return std::less<const char*>()(one->data.get(), other->data.get());
+            });
+        slabs.insert(where, std::move(slab));
+    }
+    char* result = current->data.get() + current->used;
+    memcpy(result, ptr, size);
+    current->used += size;
+    current->live += size;
+    return result;
+}
+
+size_t KeyArena::GetOverhead()const
+{
+    size_t free = 0;
+    for (const Slab* current : generations)
+    {
+        if (current)
+            free += current->size - current->used;
+    }
+    return allocated - live - free;
+}
+
+void KeyArena::Release()
+{
+    live = 0;
+    for (auto& slab : slabs)
+    {
+        if (slab->victim)
+        {
+            allocated -= slab->size;
+            ++stats.released;
+            slab.reset();
+        }
+        else
+            live += slab->live;
+    }
+    slabs.erase(std::remove(slabs.begin(), slabs.end(), nullptr), slabs.end());
+}
@@ -0,0 +1,173 @@
+#include "Lz.h"
+#include "Utils.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+const size_t min_match = 4;
+const size_t max_offset = 65535;
+//! the last match starts at least this far from the end of the block
+const size_t match_margin = 12;
+//! the last bytes of the block are always literals
+const size_t literal_margin = 5;
+const unsigned hash_bits = 12;
+
+inline uint32_t Read32(const char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t Hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - hash_bits);
+}
+
+inline char* PutLength(char* out, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        *out++ = (char)255;
+    *out++ = (char)length;
+    return out;
+}
+
+inline bool GetLength(const unsigned char*& in, const unsigned char* end, size_t& length)
+{
+    unsigned char c;
+    do
+    {
+        if (in == end)
+            return false;
+        c = *in++;
+        length += c;
+    } while (c == 255);
+    return true;
+}
+
+inline char* PutSequence(char* out, const char* literals, size_t n, size_t match)
+{
+    char* const token = out++;
+    *token = (char)((std::min<size_t>(n, 15) << 4) | std::min<size_t>(match, 15));
+    if (n >= 15)
+        out = PutLength(out, n - 15);
+    memcpy(out, literals, n);
+    return out + n;
+}
+
+}
+
+size_t LzCompress(const char* src, size_t size, char* dst, size_t capacity)
+{
+    if (capacity < LzBound(size))
+        return 0;
+    uint32_t table[1 << hash_bits] = { 0 }; // positions in src by the hash of the 4 bytes there
+    const char* const end = src + size;
+    const char* p = src;
+    const char* anchor = src; // the first byte not yet written out
+    char* out = dst;
+    if (size > match_margin)
+    {
+        const char* const limit = end - match_margin;
+        while (p < limit)
+        {
+            const uint32_t sequence = Read32(p);
+            uint32_t& slot = table[Hash(sequence)];
+            const char* candidate = src + slot;
+            slot = (uint32_t)(p - src);
+            if (candidate >= p || (size_t)(p - candidate) > max_offset || Read32(candidate) != sequence)
+            {   // skips faster through incompressible data
+                p += 1 + ((p - anchor) >> 6);
+                continue;
+            }
+            // extends the match 4 bytes at a time, the first difference is the lowest one (little endian)
+            const char* match_end = p + min_match;
+            const char* c = candidate + min_match;
+            const char* const match_limit = end - literal_margin;
+            while (match_end + 4 <= match_limit)
+            {
+                const uint32_t difference = Read32(match_end) ^ Read32(c);
+                if (difference)
+                {   // the byte loop below stops at the difference
+                    const unsigned same = CountTrailingZeros(difference) / 8;
+                    match_end += same;
+                    c += same;
+                    break;
+                }
+                match_end += 4;
+                c += 4;
+            }
+            if (match_end + 4 > match_limit)
+            {
+                for (; match_end < match_limit && *match_end == *c; ++c)
+                    ++match_end;
+            }
+            while (p > anchor && candidate > src && p[-1] == candidate[-1])
+            {
+                --p;
+                --candidate;
+            }
+            const size_t match = match_end - p - min_match;
+            out = PutSequence(out, anchor, p - anchor, match);
+            const size_t offset = p - candidate;
+            *out++ = (char)(offset & 0xFF);
+            *out++ = (char)(offset >> 8);
+            if (match >= 15)
+                out = PutLength(out, match - 15);
+            p = anchor = match_end;
+        }
+    }
+    out = PutSequence(out, anchor, end - anchor, 0);
+    return out - dst;
+}
+
+bool LzDecompress(const char* src, size_t size, char* dst, size_t raw_size)
+{
+    const unsigned char* in = (const unsigned char*)src;
+    const unsigned char* const in_end = in + size;
+    char* out = dst;
+    char* const out_end = dst + raw_size;
+    while (in < in_end)
+    {
+        const unsigned token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !GetLength(in, in_end, literals))
+            return false;
+        if ((size_t)(in_end - in) < literals || (size_t)(out_end - out) < literals)
+            return false;
+        // short copies are done in a fixed size, if there is room for the extra bytes
+        if (literals <= 16 && in_end - in >= 16 && out_end - out >= 16)
+            memcpy(out, in, 16);
+        else
+            memcpy(out, in, literals);
+        out += literals;
+        in += literals;
+        if (in == in_end)
+            break; // the last sequence
+        if (in_end - in < 2)
+            return false;
+        const size_t offset = in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        size_t match = token & 15;
+        if (match == 15 && !GetLength(in, in_end, match))
+            return false;
+        match += min_match;
+        if (offset == 0 || offset > (size_t)(out - dst) || (size_t)(out_end - out) < match)
+            return false;
+        const char* from = out - offset;
+        if (offset >= 8 && (size_t)(out_end - out) >= match + 8)
+        {   // 8 bytes at a time, overwrites at most 7 bytes after the match
+            for (size_t i = 0; i < match; i += 8)
+                memcpy(out + i, from + i, 8);
+        }
+        else
+        {   // overlapping, repeats the last offset bytes
+            for (size_t i = 0; i < match; ++i)
+                out[i] = from[i];
+        }
+        out += match;
+    }
+    return out == out_end;
+}
@@ -0,0 +1,175 @@
+#include "Tokenizer.h"
+#include "Utils.h"
+
+#include <cstring>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#   define TOKENIZER_X86
+#   include <immintrin.h>
+#   ifdef _MSC_VER
+#       define TOKENIZER_TARGET(x)
+#   else
+#       define TOKENIZER_TARGET(x) __attribute__((target(x)))
+#   endif
+#endif
+
+bool Tokenizer::table[256] = { true }; // '\0'
+unsigned char Tokenizer::vector_separators[Tokenizer::max_vector_separators] = { 0 };
+size_t Tokenizer::vector_separators_size = 1;
+Tokenizer::Engine Tokenizer::engine = Tokenizer::SCALAR;
+
+static const char* ScanScalar(const char* begin, const char* end)
+{
+    while (begin < end && !Tokenizer::table[(unsigned char)*begin])
+        ++begin;
+    return begin;
+}
+
+Tokenizer::Scanner Tokenizer::scanner = ScanScalar;
+
+#ifdef TOKENIZER_X86
+
+TOKENIZER_TARGET("sse2")
+static inline __m128i MatchSSE2(__m128i chunk, const __m128i* seps, size_t n)
+{
+    __m128i result = _mm_cmpeq_epi8(chunk, seps[0]);
+    for (size_t i = 1; i < n; ++i)
+        result = _mm_or_si128(result, _mm_cmpeq_epi8(chunk, seps[i]));
+    return result;
+}
+
+TOKENIZER_TARGET("sse2")
+static const char* ScanSSE2(const char* begin, const char* end)
+{
+    const size_t n = Tokenizer::vector_separators_size;
+    __m128i seps[Tokenizer::max_vector_separators];
+    for (size_t i = 0; i < n; ++i)
+        seps[i] = _mm_set1_epi8((char)Tokenizer::vector_separators[i]);
+
+    // two vectors at a time
+    for (; begin + 32 <= end; begin += 32)
+    {
+        const uint32_t lo = (uint32_t)_mm_movemask_epi8(MatchSSE2(_mm_loadu_si128((const __m128i*)begin), seps, n));
+        const uint32_t hi = (uint32_t)_mm_movemask_epi8(MatchSSE2(_mm_loadu_si128((const __m128i*)(begin + 16)), seps, n));
+        const uint32_t mask = lo | (hi << 16);
+        if (mask)
+            return begin + CountTrailingZeros(mask);
+    }
+    for (; begin + 16 <= end; begin += 16)
+    {
+        const uint32_t mask = (uint32_t)_mm_movemask_epi8(MatchSSE2(_mm_loadu_si128((const __m128i*)begin), seps, n));
+        if (mask)
+            return begin + CountTrailingZeros(mask);
+    }
+    return ScanScalar(begin, end);
+}
+
+TOKENIZER_TARGET("avx2")
+static inline __m256i MatchAVX2(__m256i chunk, const __m256i* seps, size_t n)
+{
+    __m256i result = _mm256_cmpeq_epi8(chunk, seps[0]);
+    for (size_t i = 1; i < n; ++i)
+        result = _mm256_or_si256(result, _mm256_cmpeq_epi8(chunk, seps[i]));
+    return result;
+}
+
+TOKENIZER_TARGET("avx2")
+static const char* ScanAVX2(const char* begin, const char* end)
+{
+    const size_t n = Tokenizer::vector_separators_size;
+    __m256i seps[Tokenizer::max_vector_separators];
+    for (size_t i = 0; i < n; ++i)
+        seps[i] = _mm256_set1_epi8((char)Tokenizer::vector_separators[i]);
+
+    for (; begin + 64 <= end; begin += 64)
+    {
+        const uint32_t lo = (uint32_t)_mm256_movemask_epi8(MatchAVX2(_mm256_loadu_si256((const __m256i*)begin), seps, n));
+        if (lo)
+            return begin + CountTrailingZeros(lo);
+        const uint32_t hi = (uint32_t)_mm256_movemask_epi8(MatchAVX2(_mm256_loadu_si256((const __m256i*)(begin + 32)), seps, n));
+        if (hi)
+            return begin + 32 + CountTrailingZeros(hi);
+    }
+    for (; begin + 32 <= end; begin += 32)
+    {
+        const uint32_t mask = (uint32_t)_mm256_movemask_epi8(MatchAVX2(_mm256_loadu_si256((const __m256i*)begin), seps, n));
+        if (mask)
+            return begin + CountTrailingZeros(mask);
+    }
+    return ScanScalar(begin, end);
+}
+
+#endif // TOKENIZER_X86
+
+bool Tokenizer::IsSupported(Engine e)
+{
+    switch (e)
+    {
+    case SCALAR: return true;
+#ifdef TOKENIZER_X86
+#   ifdef _MSC_VER
+    case SSE2: return true;
+    case AVX2:
+    {
+        int info[4];
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }
+#   else
+    case SSE2: return __builtin_cpu_supports("sse2");
+    case AVX2: return __builtin_cpu_supports("avx2");
+#   endif
+#endif
+    default: return false;
+    };
+}
+
+const char* Tokenizer::GetEngineName(Engine e)
+{
+    switch (e)
+    {
+    case SCALAR: return "scalar";
+    case SSE2: return "sse2";
+    case AVX2: return "avx2";
+    default: return "unknown";
+    };
+}
+
+bool Tokenizer::SetEngine(Engine e)
+{
+    if (!IsSupported(e) || (e != SCALAR && vector_separators_size == 0))
+        return false;
+    switch (e)
+    {
+#ifdef TOKENIZER_X86
+    case SSE2: scanner = ScanSSE2; break;
+    case AVX2: scanner = ScanAVX2; break;
+#endif
+    default: scanner = ScanScalar; break;
+    };
+    engine = e;
+    return true;
+}
+
+void Tokenizer::SetSeparators(const char* separators)
+{
+    memset(table, 0, sizeof(table));
+    table[0] = true;
+    vector_separators[0] = '\0';
+    vector_separators_size = 1;
+    for (; *separators; ++separators)
+    {
+        const unsigned char c = (unsigned char)*separators;
+        if (table[c])
+            continue; // duplicate
+        table[c] = true;
+        if (vector_separators_size > 0 && vector_separators_size < max_vector_separators)
+            vector_separators[vector_separators_size++] = c;
+        else
+            vector_separators_size = 0; // too many for the vector kernels
+    }
+
+    if (!SetEngine(AVX2) && !SetEngine(SSE2))
+        SetEngine(SCALAR);
+}
@@ -1,4 +1,7 @@
 #include "Tuple.h"
+#include "BlockReader.h"
+#include "StringSort.h"
+#include "Algorithms.h"
 
 #include <cstdlib>
 #include <iostream>
@@ -6,14 +9,18 @@
 #include <algorithm>
 #include <vector>
 #include <cstdarg>
+#include <type_traits>
 
 std::vector<Comparer> TupleView<false>::comps;
 size_t TupleView<false>::parsed_size = 0;
 int TupleView<false>::non_str_field_number = 0;
 std::vector<size_t> TupleView<false>::offsets;
 std::vector<size_t> TupleView<false>::keys;
+std::vector<bool> TupleView<false>::reversed;
+bool TupleView<false>::normalized = true;
 std::vector<ParseResult> TupleView<false>::types;
 std::string TupleView<false>::patched_format;
+std::vector<ParseOp> TupleView<false>::program;
 
 std::vector<size_t> TupleView<true>::offsets;
 std::vector<Comparer> TupleView<true>::comps;
@@ -197,6 +204,115 @@ static std::string PatchFormat(const char* format)
     return patched_format;
 }
 
+static bool IsSpace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+//! the flags of the characters in a scanf set, from after '[' until ']'
+static std::vector<char> CompileSet(const char* set, const char* end)
+{
+    std::vector<char> flags(256, 0);
+    const bool negated = set < end && *set == '^';
+    if (negated)
+        ++set;
+    const char* const first = set;
+    for (; set < end; ++set)
+    {
+        const unsigned char c = (unsigned char)*set;
+        if (c == '-' && set > first && set + 1 < end && (unsigned char)set[-1] <= (unsigned char)set[1])
+        {   // a range, like in glibc
+            for (unsigned int r = (unsigned char)set[-1]; r <= (unsigned char)set[1]; ++r)
+                flags[r] = 1;
+            ++set;
+        }
+        else
+            flags[c] = 1;
+    }
+    if (negated)
+    {
+        for (auto& flag : flags)
+            flag = !flag;
+    }
+    flags[0] = 0; // the end of the line
+    return flags;
+}
+
+/** compiles the format into ops, in the order of PatchFormat
+ *
+ * offsets are the fields of the non-skipped conversions, in order.
+ */
+static std::vector<ParseOp> CompileFormat(const char* format, const std::vector<size_t>& offsets)
+{
+    std::vector<ParseOp> program;
+    size_t field = 0;
+    while (*format)
+    {
+        ParseOp op;
+        op.type = SCANF_UNKNOWN;
+        op.c = *format;
+        op.base = 10;
+        op.width = 0;
+        op.offset = ParseOp::npos;
+        if (IsSpace(*format))
+        {
+            while (IsSpace(*format))
+                ++format;
+            op.code = ParseOp::SPACE;
+            program.push_back(op);
+            continue;
+        }
+        if (*format != '%' || format[1] == '%')
+        {
+            op.code = ParseOp::LITERAL;
+            format += *format == '%' ? 2 : 1;
+            program.push_back(op);
+            continue;
+        }
+        ++format;
+        const bool skipped = *format == '*';
+        if (skipped)
+            ++format;
+        const char* const spec = format;
+        op.type = ParseType(format);
+        if (op.type == SCANF_UNKNOWN)
+            continue; // dropped, like in PatchFormat
+        op.width = strtoul(spec, nullptr, 10);
+        const char* specifier = spec;
+        while (*specifier >= '0' && *specifier <= '9')
+            ++specifier;
+        const bool wide = *specifier == 'l' && (op.type == SCANF_WSTRING || op.type == SCANF_WCHAR);
+        while (strchr("hlzL", *specifier))
+            ++specifier;
+        if (!skipped && field < offsets.size())
+            op.offset = offsets[field++];
+        switch (*specifier)
+        {
+        case 'd': op.code = ParseOp::INTEGER; break;
+        case 'i': op.code = ParseOp::INTEGER; op.base = 0; break;
+        case 'u': op.code = ParseOp::INTEGER; break;
+        case 'o': op.code = ParseOp::INTEGER; op.base = 8; break;
+        case 'x': op.code = ParseOp::INTEGER; op.base = 16; break;
+        case 'f':
+        case 'e':
+        case 'g': op.code = ParseOp::FLOAT; break;
+        case 's': op.code = ParseOp::STRING; break;
+        case '[': op.code = ParseOp::SET; op.set = CompileSet(specifier + 1, format - 1); break;
+        case 'c': op.code = ParseOp::CHAR; break;
+        case 'n': op.code = ParseOp::COUNT; break;
+        default: op.code = ParseOp::SCANF; break;
+        }
+        if (wide || (op.code == ParseOp::CHAR && op.width > 1))
+            op.code = ParseOp::SCANF;
+        {   // only the position of a string is stored, the string is skipped
+            const bool position = op.type == SCANF_STRING || op.type == SCANF_WSTRING;
+            op.spec = (skipped || position ? "%*" : "%") + std::string(spec, format) + "%n";
+        }
+        program.push_back(op);
+    }
+    return program;
+}
+
 bool TupleView<false>::InitParse(const char* format, const std::vector<int>& signed_keys)
 {
     non_str_field_number = 0;
@@ -222,17 +338,23 @@ bool TupleView<false>::InitParse(const char* format, const std::vector<int>& sig
                 offset += size_of(type.type);
             }
     }
+    program = CompileFormat(format, offsets);
 
     comps.clear();
     keys.clear();
+    reversed.clear();
+    normalized = true;
     for (auto kk : signed_keys)
     {
-        const bool reversed = kk < 0;
+        const bool reverse = kk < 0;
         const size_t k = std::abs(kk) - 1;
         if (k < types.size())
         {
-            comps.emplace_back(MakeComparer(types[k].type, reversed));
+            comps.emplace_back(MakeComparer(types[k].type, reverse));
             keys.emplace_back(k);
+            reversed.push_back(reverse);
+            if (types[k].type == SCANF_WSTRING || types[k].type == SCANF_LDOUBLE)
+                normalized = false;
             //types.emplace_back(raw_types[k]);
             //offsets.emplace_back(raw_offsets[k]);
         }
@@ -372,127 +494,548 @@ Comparer MakeComparer(FormatType type, bool reverse)
     return reverse ? MakeComparer<true>(type) : MakeComparer<false>(type);
 }
 
-bool ParseText(const char* str, std::vector<char>& parsed) noexcept
-{
-    const auto& offsets = TupleView<false>::offsets;
-    const auto& fmt = TupleView<false>::patched_format.c_str();
-
-    int result = 0;
-    switch (offsets.size())
-    {
-    case 0: result = sscanf(str, fmt); break;
-    case 1: result = sscanf(str, fmt, parsed.data() + offsets[0]); break;
-    case 2: result = sscanf(str, fmt, parsed.data() + offsets[0],
-                                      parsed.data() + offsets[1]); break;
-    case 3: result = sscanf(str, fmt, parsed.data() + offsets[0],
-                                      parsed.data() + offsets[1],
-                                      parsed.data() + offsets[2]); break;
-    case 4: result = sscanf(str, fmt, parsed.data() + offsets[0],
-                                      parsed.data() + offsets[1],
-                                      parsed.data() + offsets[2],
-                                      parsed.data() + offsets[3]); break;
-    case 5: result = sscanf(str, fmt, parsed.data() + offsets[0],
-                                      parsed.data() + offsets[1],
-                                      parsed.data() + offsets[2],
-                                      parsed.data() + offsets[3],
-                                      parsed.data() + offsets[4]); break;
-    case 6: result = sscanf(str, fmt, parsed.data() + offsets[0],
-                                      parsed.data() + offsets[1],
-                                      parsed.data() + offsets[2],
-                                      parsed.data() + offsets[3],
-                                      parsed.data() + offsets[4],
-                                      parsed.data() + offsets[5]); break;
-    case 7: result = sscanf(str, fmt, parsed.data() + offsets[0],
-                                      parsed.data() + offsets[1],
-                                      parsed.data() + offsets[2],
-                                      parsed.data() + offsets[3],
-                                      parsed.data() + offsets[4],
-                                      parsed.data() + offsets[5],
-                                      parsed.data() + offsets[6]); break;
-    case 8: result = sscanf(str, fmt, parsed.data() + offsets[0],
-                                      parsed.data() + offsets[1],
-                                      parsed.data() + offsets[2],
-                                      parsed.data() + offsets[3],
-                                      parsed.data() + offsets[4],
-                                      parsed.data() + offsets[5],
-                                      parsed.data() + offsets[6],
-                                      parsed.data() + offsets[7]); break;
-    case 9: result = sscanf(str, fmt, parsed.data() + offsets[0],
-                                      parsed.data() + offsets[1],
-                                      parsed.data() + offsets[2],
-                                      parsed.data() + offsets[3],
-                                      parsed.data() + offsets[4],
-                                      parsed.data() + offsets[5],
-                                      parsed.data() + offsets[6],
-                                      parsed.data() + offsets[7],
-                                      parsed.data() + offsets[8]); break;
-    case 10:result = sscanf(str, fmt, parsed.data() + offsets[0],
-                                      parsed.data() + offsets[1],
-                                      parsed.data() + offsets[2],
-                                      parsed.data() + offsets[3],
-                                      parsed.data() + offsets[4],
-                                      parsed.data() + offsets[5],
-                                      parsed.data() + offsets[6],
-                                      parsed.data() + offsets[7],
-                                      parsed.data() + offsets[8],
-                                      parsed.data() + offsets[9]); break;
-    default:
-        std::cerr << "You cannot have " << offsets.size() << " fields in the text format!" << std::endl;
-        std::cerr << "You can remedy this situation by extending the switch cases in " << __FUNCTION__ << std::endl;
-        exit(1);
-    };
+namespace {
 
-    return result == TupleView<false>::non_str_field_number;
+template<typename T>
+inline void Store(char* parsed, size_t offset, T value)
+{
+    memcpy(parsed + offset, &value, sizeof(T));
+}
 
-    /*
-        Oh, boy, I tried, tried and failed!
-    */
-    //static std::vector<void*> vaargs;
-    //vaargs.clear();
-    //for (auto i : TupleView<false>::offsets)
-    //    vaargs.emplace_back(parsed.data() + i);
-    //void* arg_start = vaargs[0];
-    //va_list vaarg;
-    //va_start(vaarg, arg_start);
+//! stores an integer by the type of the field, truncated like sscanf does
+void StoreInteger(char* parsed, const ParseOp& op, unsigned long long bits)
+{
+    switch (op.type)
+    {
+    case SCANF_CHAR:    Store(parsed, op.offset, (char)bits); break;
+    case SCANF_UCHAR:   Store(parsed, op.offset, (unsigned char)bits); break;
+    case SCANF_SHORT:   Store(parsed, op.offset, (short int)bits); break;
+    case SCANF_USHORT:  Store(parsed, op.offset, (unsigned short int)bits); break;
+    case SCANF_INT:     Store(parsed, op.offset, (int)bits); break;
+    case SCANF_UINT:    Store(parsed, op.offset, (unsigned int)bits); break;
+    case SCANF_LONG:    Store(parsed, op.offset, (long int)bits); break;
+    case SCANF_ULONG:   Store(parsed, op.offset, (unsigned long int)bits); break;
+    case SCANF_LLONG:   Store(parsed, op.offset, (long long int)bits); break;
+    case SCANF_ULLONG:  Store(parsed, op.offset, (unsigned long long int)bits); break;
+    case SCANF_SIZET:   Store(parsed, op.offset, (size_t)bits); break;
+    default: break;
+    }
+}
 
-    //int result = vsscanf(str, (const char*)(vaargs[0]), vaarg);
-    //va_end(vaarg);
-    //return result == TupleView<false>::non_str_field_number;
+//! the conversion by sscanf itself, 1 if read, 0 if it does not match, EOF at the end of str
+int Scan(const char*& p, const ParseOp& op, char* parsed, bool store)
+{
+    int n = -1;
+    const int result = store ? sscanf(p, op.spec.c_str(), parsed + op.offset, &n) : sscanf(p, op.spec.c_str(), &n);
+    if (result == EOF)
+        return EOF;
+    if (n < 0)
+        return 0;
+    p += n;
+    return 1;
+}
 
-    // result = vsscanf(str, fmt, (va_list)vaargs.data());
+//! reads a decimal short enough to fit into a long digit by digit, false if it is not one
+bool ReadInteger(const char*& p, const ParseOp& op, char* parsed, bool store)
+{
+    static const size_t fast_digits = sizeof(long) >= 8 ? 18 : 9;
+    if (op.base != 10)
+        return false;
+    const char* q = p;
+    const bool negative = *q == '-';
+    if (*q == '-' || *q == '+')
+        ++q;
+    const char* const digits = q;
+    unsigned long long value = 0;
+    while (*q >= '0' && *q <= '9' && (size_t)(q - digits) < fast_digits)
+        value = value * 10 + (unsigned long long)(*q++ - '0');
+    if (q == digits || (*q >= '0' && *q <= '9') || (op.width > 0 && (size_t)(q - p) > op.width))
+        return false;
+    // stored like sscanf does, the long is truncated to the type
+    if (store)
+        StoreInteger(parsed, op, negative ? 0 - value : value);
+    p = q;
+    return true;
 }
 
-template<>
-bool Packet<TupleView<true>>::ReadFrom(FILE* f)
+/** reads a short decimal floating point number, false if it is not one
+ *
+ * At most 19 digits with a small exponent are exact in a double (in a
+ * float, with fewer digits), so one multiplication or division rounds
+ * them correctly. The rest (long or hexadecimal numbers, inf, nan) are
+ * left to sscanf.
+ */
+bool ReadFloat(const char*& p, const ParseOp& op, char* parsed, bool store)
 {
-    resize(view.size);
-    if (fread(data(), view.size, 1, f))
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    if (op.width > 0 || (op.type != SCANF_FLOAT && op.type != SCANF_DOUBLE))
+        return false;
+    const char* q = p;
+    const bool negative = *q == '-';
+    if (*q == '-' || *q == '+')
+        ++q;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for (; *q >= '0' && *q <= '9'; ++q, any = true)
+    {
+        if (digits > 0 || *q != '0')
+            ++digits;
+        mantissa = mantissa * 10 + (uint64_t)(*q - '0');
+    }
+    if (*q == '.')
     {
-        view.ptr = data();
-        return true;
+        for (++q; *q >= '0' && *q <= '9'; ++q, any = true)
+        {
+            if (digits > 0 || *q != '0')
+                ++digits;
+            mantissa = mantissa * 10 + (uint64_t)(*q - '0');
+            --exponent;
+        }
+    }
+    if (!any || digits > 19 || *q == 'x' || *q == 'X')
+        return false;
+    if (*q == 'e' || *q == 'E')
+    {   // sscanf fails on an exponent without digits
+        ++q;
+        const bool negative_exponent = *q == '-';
+        if (*q == '-' || *q == '+')
+            ++q;
+        if (!(*q >= '0' && *q <= '9'))
+            return false;
+        int value = 0;
+        for (; *q >= '0' && *q <= '9'; ++q)
+            value = std::min(value * 10 + (*q - '0'), 1000);
+        exponent += negative_exponent ? -value : value;
+    }
+    if (op.type == SCANF_FLOAT && mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10)
+    {
+        float value = (float)mantissa;
+        value = exponent < 0 ? value / (float)powers[-exponent] : value * (float)powers[exponent];
+        if (store)
+            Store(parsed, op.offset, negative ? -value : value);
+    }
+    else if (op.type == SCANF_DOUBLE && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22)
+    {
+        double value = (double)mantissa;
+        value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+        if (store)
+            Store(parsed, op.offset, negative ? -value : value);
     }
     else
         return false;
+    p = q;
+    return true;
+}
+
+}
+
+bool ParseText(const char* str, char* parsed) noexcept
+{
+    const char* p = str;
+    int assigned = 0;
+    bool input_failure = false;
+    for (const auto& op : TupleView<false>::program)
+    {
+        const bool store = op.offset != ParseOp::npos;
+        if (op.code == ParseOp::SPACE)
+        {
+            while (IsSpace(*p))
+                ++p;
+            continue;
+        }
+        if (op.code == ParseOp::COUNT)
+        {
+            if (store)
+                StoreInteger(parsed, op, (unsigned long long)(p - str));
+            continue;
+        }
+        if (op.code == ParseOp::STRING || ((op.code == ParseOp::SET || op.code == ParseOp::SCANF) &&
+            (op.type == SCANF_STRING || op.type == SCANF_WSTRING)))
+        {   // the position of the string, before its white-space (like %zn)
+            if (store)
+                Store(parsed, op.offset, (size_t)(p - str));
+        }
+        // %c, %[ and the characters do not skip the white-space, sscanf skips it itself
+        if (op.code != ParseOp::CHAR && op.code != ParseOp::SET && op.code != ParseOp::SCANF &&
+            !(op.code == ParseOp::LITERAL && op.c != '%'))
+        {
+            while (IsSpace(*p))
+                ++p;
+        }
+        if (*p == '\0' && op.code != ParseOp::SCANF)
+        {
+            input_failure = true;
+            break;
+        }
+        bool matched = true;
+        switch (op.code)
+        {
+        case ParseOp::LITERAL:
+            matched = *p == op.c;
+            p += matched;
+            break;
+        case ParseOp::INTEGER:
+            matched = ReadInteger(p, op, parsed, store) || Scan(p, op, parsed, store) > 0;
+            break;
+        case ParseOp::FLOAT:
+            matched = ReadFloat(p, op, parsed, store) || Scan(p, op, parsed, store) > 0;
+            break;
+        case ParseOp::STRING:
+        {
+            const char* const end = op.width > 0 ? p + op.width : nullptr;
+            while (*p && !IsSpace(*p) && p != end)
+                ++p;
+            break;
+        }
+        case ParseOp::SET:
+        {
+            const char* const begin = p;
+            const char* const end = op.width > 0 ? p + op.width : nullptr;
+            while (op.set[(unsigned char)*p] && p != end)
+                ++p;
+            matched = p > begin;
+            break;
+        }
+        case ParseOp::CHAR:
+            if (store)
+                Store(parsed, op.offset, *p);
+            ++p;
+            break;
+        default:
+        {   // the string positions are stored already
+            const int result = Scan(p, op, parsed, store && op.type != SCANF_STRING && op.type != SCANF_WSTRING);
+            input_failure = result == EOF;
+            matched = result > 0;
+            break;
+        }
+        }
+        if (input_failure || !matched)
+            break;
+        if (store && op.code != ParseOp::LITERAL && op.type != SCANF_STRING && op.type != SCANF_WSTRING)
+            ++assigned;
+    }
+    // sscanf returns EOF if the line ends before the first conversion
+    return (input_failure && assigned == 0 ? -1 : assigned) == TupleView<false>::non_str_field_number;
+}
+
+template<>
+bool Packet<TupleView<true>>::ReadFrom(BlockReader& reader)
+{
+    view.ptr = reader.Take(view.size, *this);
+    return view.ptr != nullptr;
+}
+
+namespace {
+
+//! appends the bits big-endian, inverted if reversed
+template<typename U>
+void PutBits(Buffer& key, U bits, bool reversed)
+{
+    if (reversed)
+        bits = (U)~bits;
+    for (size_t i = sizeof(U); i-- > 0;)
+        key.push_back((char)(bits >> (8 * i)));
+}
+
+template<typename T>
+void PutInteger(Buffer& key, const char* field, bool reversed)
+{
+    typedef typename std::make_unsigned<T>::type U;
+    T value;
+    memcpy(&value, field, sizeof(T));
+    U bits = (U)value;
+    if (std::is_signed<T>::value)
+        bits ^= (U)((U)1 << (8 * sizeof(U) - 1));
+    PutBits(key, bits, reversed);
+}
+
+template<typename T, typename U>
+void PutFloat(Buffer& key, const char* field, bool reversed)
+{
+    static_assert(sizeof(T) == sizeof(U), "the bits of the float");
+    const U sign = (U)1 << (8 * sizeof(U) - 1);
+    T value;
+    memcpy(&value, field, sizeof(T));
+    if (value == 0)
+        value = 0; // -0 equals 0
+    U bits;
+    memcpy(&bits, &value, sizeof(U));
+    PutBits(key, (bits & sign) ? (U)~bits : (U)(bits | sign), reversed);
+}
+
+}
+
+void TupleView<false>::Normalize(const char* line, const Buffer& fields, size_t at, Buffer& key)
+{
+    for (size_t i = 0; i < keys.size(); ++i)
+    {   // the field is read before the key grows
+        const size_t k = keys[i];
+        const char* const field = fields.data() + at + offsets[k];
+        const bool reverse = reversed[i];
+        switch (types[k].type)
+        {
+        case SCANF_STRING:
+        {
+            const char* s = line + *(const size_t*)field;
+            const size_t length = strlen(s);
+            if (reverse)
+            {
+                for (size_t j = 0; j < length; ++j)
+                    key.push_back((char)~s[j]);
+            }
+            else
+                key.insert(key.end(), s, s + length);
+            key.push_back(reverse ? (char)0xFF : '\0');
+            break;
+        }
+        case SCANF_CHAR:    PutInteger<char>(key, field, reverse); break;
+        case SCANF_WCHAR:   PutInteger<wchar_t>(key, field, reverse); break;
+        case SCANF_UCHAR:   PutInteger<unsigned char>(key, field, reverse); break;
+        case SCANF_SHORT:   PutInteger<short int>(key, field, reverse); break;
+        case SCANF_USHORT:  PutInteger<unsigned short int>(key, field, reverse); break;
+        case SCANF_INT:     PutInteger<int>(key, field, reverse); break;
+        case SCANF_UINT:    PutInteger<unsigned int>(key, field, reverse); break;
+        case SCANF_LONG:    PutInteger<long int>(key, field, reverse); break;
+        case SCANF_ULONG:   PutInteger<unsigned long int>(key, field, reverse); break;
+        case SCANF_LLONG:   PutInteger<long long int>(key, field, reverse); break;
+        case SCANF_ULLONG:  PutInteger<unsigned long long int>(key, field, reverse); break;
+        case SCANF_SIZET:   PutInteger<size_t>(key, field, reverse); break;
+        case SCANF_PTR:     PutInteger<uintptr_t>(key, field, reverse); break;
+        case SCANF_FLOAT:   PutFloat<float, uint32_t>(key, field, reverse); break;
+        case SCANF_DOUBLE:  PutFloat<double, uint64_t>(key, field, reverse); break;
+        default: break; // equal, like its comparer
+        }
+    }
+}
+
+bool TupleView<false>::ParseLine() noexcept
+{
+    parsed.resize(parsed_size);
+    if (!ParseText(ptr, parsed.data()))
+        return false;
+    if (normalized)
+        Normalize(ptr, parsed, 0, parsed);
+    return true;
+}
+
+bool TupleView<false>::Less(const char* a, const char* fields_a, const char* b, const char* fields_b)
+{
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        const auto& k = keys[i];
+        const char *x, *y;
+        if (types[k].type == SCANF_STRING || types[k].type == SCANF_WSTRING)
+        {
+            x = a + *(const size_t*)(fields_a + offsets[k]);
+            y = b + *(const size_t*)(fields_b + offsets[k]);
+        }
+        else
+        {
+            x = fields_a + offsets[k];
+            y = fields_b + offsets[k];
+        }
+        switch (comps[i](x, y))
+        {
+        case -1: return true;
+        case  1: return false;
+        default: continue;
+        }
+    }
+    return false;
+}
+
+TupleBatch::TupleBatch() : sorter(LineKey{ this }), key_is_line(false)
+{
+}
+
+std::pair<const char*, size_t> TupleBatch::Key(size_t i)const
+{
+    if (key_is_line)
+    {   // the rest of the line, from the string
+        const size_t field = TupleView<false>::offsets[TupleView<false>::keys[0]];
+        const size_t pos = *(const size_t*)(fields.data() + i * TupleView<false>::parsed_size + field);
+        return std::make_pair(lines[i].ptr + pos, lines[i].size - 1 - pos);
+    }
+    const size_t begin = i > 0 ? key_ends[i - 1] : 0;
+    return std::make_pair(keys.data() + begin, key_ends[i] - begin);
+}
+
+bool TupleBatch::Before(size_t i, size_t j)const
+{
+    if (TupleView<false>::normalized)
+    {
+        const auto a = Key(i), b = Key(j);
+        const int c = memcmp(a.first, b.first, std::min(a.second, b.second));
+        if (c != 0 || a.second != b.second)
+            return c < 0 || (c == 0 && a.second < b.second);
+    }
+    else
+    {
+        const size_t parsed_size = TupleView<false>::parsed_size;
+        const char* fields_i = fields.data() + i * parsed_size;
+        const char* fields_j = fields.data() + j * parsed_size;
+        if (TupleView<false>::Less(lines[i].ptr, fields_i, lines[j].ptr, fields_j))
+            return true;
+        if (TupleView<false>::Less(lines[j].ptr, fields_j, lines[i].ptr, fields_i))
+            return false;
+    }
+    return i < j;
+}
+
+void TupleBatch::Read(char*& begin, char* end)
+{
+    const auto& keys_of = TupleView<false>::keys;
+    key_is_line = keys_of.size() == 1 && TupleView<false>::types[keys_of[0]].type == SCANF_STRING &&
+        !TupleView<false>::reversed[0];
+    const size_t parsed_size = TupleView<false>::parsed_size;
+    const bool normalize = TupleView<false>::normalized && !key_is_line;
+    DataView<false> line;
+    while (line.ReadFrom(begin, end))
+    {
+        const size_t at = fields.size();
+        fields.resize(at + parsed_size);
+        if (!ParseText(line.ptr, fields.data() + at))
+        {
+            fields.resize(at);
+            continue;
+        }
+        lines.push_back(line);
+        if (normalize)
+        {
+            TupleView<false>::Normalize(line.ptr, fields, at, keys);
+            key_ends.push_back(keys.size());
+        }
+    }
+}
+
+//! fewer records are not worth a thread
+static const size_t min_chunk = 1 << 12;
+
+std::pair<const DataView<false>*, const DataView<false>*> TupleBatch::Sort(size_t threads)
+{
+    const size_t n = lines.size();
+    const size_t chunks = std::max<size_t>(1, std::min(threads, n / min_chunk));
+    if (chunks == 1 && TupleView<false>::normalized)
+    {
+        sorter.Sort(lines.data(), lines.data() + n);
+        return std::make_pair(lines.data(), lines.data() + n);
+    }
+    // the indices of the lines are sorted, then the lines are gathered
+    const auto before = [this](size_t i, size_t j) { return Before(i, j); };
+    while (bucket_sorters.size() < chunks)
+        bucket_sorters.emplace_back(IndexKey{ this });
+    const auto sort_bucket = [&](size_t* begin, size_t* end, size_t b)
+    {
+        if (TupleView<false>::normalized)
+            bucket_sorters[b].Sort(begin, end);
+        else
+            std::stable_sort(begin, end, before);
+    };
+    indices.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        indices[i] = i;
+    order.resize(n);
+    if (chunks > 1)
+        ParallelSampleSort(indices.data(), n, order.data(), chunks, before, sort_bucket);
+    else
+    {
+        order.swap(indices);
+        sort_bucket(order.data(), order.data() + n, 0);
+    }
+    sorted.resize(n);
+    ParallelFor(chunks, [&](size_t c)
+    {
+        for (size_t i = c * n / chunks; i < (c + 1) * n / chunks; ++i)
+            sorted[i] = lines[order[i]];
+    });
+    lines.swap(sorted);
+    return std::make_pair(lines.data(), lines.data() + n);
+}
+
+void TupleBatch::Clear()
+{
+    lines.clear();
+    fields.clear();
+    keys.clear();
+    key_ends.clear();
+}
+
+size_t TupleBatch::GetAllocated()const
+{
+    return (lines.capacity() + sorted.capacity()) * sizeof(DataView<false>) + fields.capacity() + keys.capacity() +
+        (key_ends.capacity() + indices.capacity() + order.capacity()) * sizeof(size_t);
+}
+
+void SortRun(TupleView<true>* begin, TupleView<true>* end, size_t threads)
+{
+    const size_t n = end - begin;
+    const size_t chunks = std::min(threads, n / min_chunk);
+    if (chunks < 2)
+    {
+        std::stable_sort(begin, end);
+        return;
+    }
+    // the records were read from one buffer, their place breaks the ties
+    std::vector<TupleView<true>> sorted(n);
+    ParallelSampleSort(begin, n, sorted.data(), chunks, [](const TupleView<true>& a, const TupleView<true>& b)
+    {
+        return a < b || (!(b < a) && a.ptr < b.ptr);
+    },
+    [](TupleView<true>* bucket_begin, TupleView<true>* bucket_end, size_t)
+    {
+        std::stable_sort(bucket_begin, bucket_end);
+    });
+    std::copy(sorted.begin(), sorted.end(), begin);
 }
 
 bool TupleView<false>::ReadFrom(char*& buffer, char* end) noexcept
 {
-    return (DataView<false>::ReadFrom(buffer, end)) &&
-        ParseText(ptr, parsed);
+    return (DataView<false>::ReadFrom(buffer, end)) && ParseLine();
 }
 
 template<>
-bool Packet<TupleView<false>>::ReadFrom(FILE* f)
+bool Packet<TupleView<false>>::ReadFrom(BlockReader& reader)
 {
-    clear();
-    int c;
-    while ((c = fgetc(f)) != EOF && (char)c != view.separators[0])
+    size_t size;
+    char* p = reader.Until(view.separators[0], size, *this);
+    if (p == nullptr)
+        return false;
+    p[size] = '\0';
+    view.size = size + 1;
+    view.ptr = p;
+    return view.ParseLine();
+}
+
+template<>
+bool Packet<TupleView<false>>::ReadFrom(RunReader& run)
+{
+    char* key;
+    size_t size;
+    uint64_t count;
+    if (!run.Next(key, size, count, *this))
+        return false;
+    view.size = size + 1;
+    view.ptr = key;
+    return view.ParseLine();
+}
+
+size_t DumpRun(const DataView<false>* begin, const DataView<false>* end, const std::string& filename, bool compress)
+{
+    size_t written = 0;
+    if (begin < end)
     {
-        emplace_back((char)c);
+        FILE* f = fopen(filename.c_str(), "wb");
+        if (f)
+        {
+            RunWriter writer(f, false, compress, true, false);
+            for (; begin < end && writer.Write(begin->ptr, begin->size - 1, 1); ++begin)
+                ++written;
+            if (!writer.Flush())
+                written = 0;
+            fclose(f);
+        }
     }
-    emplace_back('\0');
-    view.size = size();
-    view.ptr = data();
-    return ParseText(view.ptr, view.parsed);
-    // return c != EOF || size() > 1;
+    return written;
 }
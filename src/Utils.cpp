@@ -4,10 +4,14 @@
 #include <cstdio>
 #include <vector>
 #include <type_traits>
+#include <cstdint>
 
 #ifdef _MSC_VER
 #   include <fcntl.h>
 #   include <io.h>
+#   include <stdio.h>
+#else
+#   include <sys/resource.h>
 #endif
 
 std::string GetFilename(size_t i, int width, const char* prefix)
@@ -17,6 +21,34 @@ std::string GetFilename(size_t i, int width, const char* prefix)
     return std::string(buffer.data());
 }
 
+size_t GetFileSize(const std::string& filename)
+{
+    size_t result = 0;
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (f)
+    {
+        if (fseek(f, 0, SEEK_END) == 0)
+        {
+            const long size = ftell(f);
+            result = size > 0 ? (size_t)size : 0;
+        }
+        fclose(f);
+    }
+    return result;
+}
+
+size_t MaxOpenFiles()
+{
+#ifdef _MSC_VER
+    return (size_t)_getmaxstdio();
+#else
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        return (size_t)limit.rlim_cur;
+    return 1024;
+#endif
+}
+
 bool SetBinaryIO()
 {
 #ifdef _MSC_VER
@@ -53,3 +85,121 @@ size_t Fnv1a::operator()(const char * ptr, size_t size)const
 {
     return hash(ptr, size);
 }
+
+static const uint64_t wyp[4] = { 0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull };
+
+//! 64x64 -> 128 bit multiplication, the two halves are returned in a and b
+static inline void wymum(uint64_t& a, uint64_t& b)
+{
+#if defined(__SIZEOF_INT128__)
+    const __uint128_t r = (__uint128_t)a * b;
+    a = (uint64_t)r;
+    b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    a = _umul128(a, b, &b);
+#else
+    const uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+    const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    const uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    const uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    const uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    a = lo;
+    b = hi;
+#endif
+}
+
+static inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+    wymum(a, b);
+    return a ^ b;
+}
+
+static inline uint64_t wyr8(const char* p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t wyr4(const char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t wyr3(const char* p, size_t k)
+{
+    return (((uint64_t)(unsigned char)p[0]) << 16) | (((uint64_t)(unsigned char)p[k >> 1]) << 8) | (unsigned char)p[k - 1];
+}
+
+size_t WyHash::hash(const char * ptr, size_t size)
+{
+    uint64_t seed = wymix(wyp[0], wyp[1]);
+    uint64_t a, b;
+    if (size <= 16)
+    {
+        if (size >= 4)
+        {
+            a = (wyr4(ptr) << 32) | wyr4(ptr + ((size >> 3) << 2));
+            b = (wyr4(ptr + size - 4) << 32) | wyr4(ptr + size - 4 - ((size >> 3) << 2));
+        }
+        else if (size > 0)
+        {
+            a = wyr3(ptr, size);
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else
+    {
+        size_t i = size;
+        if (i > 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do
+            {
+                seed = wymix(wyr8(ptr) ^ wyp[1], wyr8(ptr + 8) ^ seed);
+                see1 = wymix(wyr8(ptr + 16) ^ wyp[2], wyr8(ptr + 24) ^ see1);
+                see2 = wymix(wyr8(ptr + 32) ^ wyp[3], wyr8(ptr + 40) ^ see2);
+                ptr += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16)
+        {
+            seed = wymix(wyr8(ptr) ^ wyp[1], wyr8(ptr + 8) ^ seed);
+            i -= 16;
+            ptr += 16;
+        }
+        a = wyr8(ptr + i - 16);
+        b = wyr8(ptr + i - 8);
+    }
+    a ^= wyp[1];
+    b ^= seed;
+    wymum(a, b);
+    const uint64_t result = wymix(a ^ wyp[0] ^ size, b ^ wyp[1]);
+    return sizeof(size_t) == 8 ? (size_t)result : (size_t)(result ^ (result >> 32));
+}
+
+size_t WyHash::operator()(const char * ptr, size_t size)const
+{
+    return hash(ptr, size);
+}
+
+KeyHash::Function KeyHash::function = WyHash::hash;
+
+bool KeyHash::Set(const char* name)
+{
+    if (strcmp(name, "wyhash") == 0)
+        function = WyHash::hash;
+    else if (strcmp(name, "fnv1a") == 0)
+        function = Fnv1a::hash;
+    else
+        return false;
+    return true;
+}
@@ -4,117 +4,847 @@
 
 #include <vector>
 #include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <limits>
+#include <atomic>
+#include <type_traits>
 
 #include "Algorithms.h"
 #include "DataTypes.h"
 #include "Hash.h"
+#include "KeyArena.h"
+#include "SpaceSaving.h"
 #include "ProgressIndicator.h"
 
 struct Args
 {
-    double rehash_constant, expand_constant, keep_factor;
+    double rehash_constant, expand_constant, keep_factor, max_garbage;
     
     size_t binary_size, buffer_size;
     int width;
 
     const char* prefix;
     const char** filenames;
+    std::vector<std::string> inputs;
     std::string separators;
-    bool logging, merge, do_delete, async;
+    std::string table;
+    const char* hash;
+    size_t threads;
+    size_t heavy, min_count;
+    const char* bounds;
+    size_t grace, fan_in, readers;
+    IoBackend io;
+    bool logging, merge, do_delete, async, compress, direct, background;
 
     Args() : 
-        rehash_constant(0.75), expand_constant(2.0), keep_factor(0.5),
+        rehash_constant(0.75), expand_constant(2.0), keep_factor(0.5), max_garbage(0.25),
         binary_size(0), buffer_size(((size_t)1) << 25), width(3),
-        prefix(""), filenames(nullptr), separators("\t\n\v\f\r"),
-        logging(false), merge(true), do_delete(true), async(false)
+        prefix(""), filenames(nullptr), separators("\t\n\v\f\r"), table("group"), hash("wyhash"), threads(1),
+        heavy(0), min_count(1), bounds(nullptr), grace(0), fan_in(0), readers(1), io(IoBackend::sync),
+        logging(false), merge(true), do_delete(true), async(false), compress(false), direct(false), background(false)
     {}
 };
 
-template<bool binary, bool pre_sorted>
-std::pair<size_t, size_t> sum_up_lengths(const HashTable<binary>& hash_table, size_t buffer_size)
+template<typename Table>
+std::pair<size_t, size_t> sum_up_lengths(const Table& hash_table, size_t buffer_size)
 {
     std::pair<size_t, size_t> remain(0, 0);
-    if (binary)
+    if (Table::value_type::binary)
     {
         remain.first = buffer_size / hash_table.GetTable()->size;
         remain.second = hash_table.GetSize() * hash_table.GetTable()->size;
     }
     else
     {
-        if (pre_sorted)
+        auto end = hash_table.GetTable() + hash_table.GetAllocatedSize();
+        for (auto rec = hash_table.GetTable(); rec < end; ++rec)
         {
-            auto end = hash_table.GetTable() + hash_table.GetSize();
-            for (auto rec = hash_table.GetTable(); rec < end; ++rec)
+            if (rec->ptr)
             {
                 if ((remain.second += rec->size) <= buffer_size)
                     ++remain.first;
-                else 
-                    break;
             }
         }
-        else
+    }
+    return remain;
+}
+
+/** order of the records with the same count, when only some of them can be kept
+ *
+ * Slot order would keep the records of the low slots and those would crowd
+ * the front of the table after the rehash, so it is mixed from the hash.
+ */
+inline uint32_t TieOrder(size_t hash)
+{
+    return (uint32_t)(((uint64_t)hash * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/** decides which records to keep in memory, without sorting the table by frequency
+ *
+ * Keeps keep_factor times as many of the most frequent records, as many of
+ * them would fit into buffer_size, ties are broken by TieOrder.
+ * The kept records are moved to the front, the ones to dump are sorted
+ * lexicographically after them (if sort is true).
+ * Returns the number of kept records.
+ * Counts below 'levels' are collected into a histogram, the few records
+ * above that are sorted.
+ */
+template<typename Table>
+size_t plan_spill(Table& hash_table, size_t buffer_size, double keep_factor, bool sort = true)
+{
+    typedef typename Table::value_type Record;
+    static const size_t levels = 4096;
+    std::vector<size_t> level_records(levels, 0), level_bytes(levels, 0);
+    std::vector<const Record*> frequent; // count >= levels
+
+    const auto end = hash_table.GetTable() + hash_table.GetAllocatedSize();
+    for (auto rec = hash_table.GetTable(); rec < end; ++rec)
+    {
+        if (rec->ptr)
+        {
+            if (rec->count < levels)
+            {
+                ++level_records[rec->count];
+                level_bytes[rec->count] += rec->size;
+            }
+            else
+                frequent.push_back(rec);
+        }
+    }
+    std::sort(frequent.begin(), frequent.end(),
+        [](const Record* one, const Record* other) { return one->count > other->count; });
+
+    // number of the most frequent records that fit into the buffer
+    size_t fit = 0, bytes = 0;
+    bool full = false;
+    for (auto rec : frequent)
+    {
+        if ((bytes += rec->size) > buffer_size)
+        {
+            full = true;
+            break;
+        }
+        ++fit;
+    }
+    for (size_t c = levels - 1; !full && c > 0; --c)
+    {
+        if (bytes + level_bytes[c] <= buffer_size)
         {
-            auto end = hash_table.GetTable() + hash_table.GetAllocatedSize();
+            bytes += level_bytes[c];
+            fit += level_records[c];
+        }
+        else
+        {   // this level fits partially, in slot order
             for (auto rec = hash_table.GetTable(); rec < end; ++rec)
             {
-                if (rec->ptr)
+                if (rec->ptr && rec->count == c)
                 {
-                    if ((remain.second += rec->size) <= buffer_size)
-                        ++remain.first;
+                    if ((bytes += rec->size) > buffer_size)
+                        break;
+                    ++fit;
                 }
             }
+            full = true;
         }
     }
-    return remain;
+
+    // keep everything above 'threshold' and the first 'ties' records with count 'threshold' in TieOrder
+    const size_t keep = (size_t)std::floor(fit * keep_factor);
+    size_t threshold = std::numeric_limits<size_t>::max(), ties = 0;
+    if (keep > 0)
+    {
+        if (keep <= frequent.size())
+        {
+            threshold = frequent[keep - 1]->count;
+            ties = keep - (std::lower_bound(frequent.begin(), frequent.end(), threshold,
+                [](const Record* rec, size_t count) { return rec->count > count; }) - frequent.begin());
+        }
+        else
+        {
+            size_t taken = frequent.size();
+            for (size_t c = levels - 1; c > 0; --c)
+            {
+                if (taken + level_records[c] >= keep)
+                {
+                    threshold = c;
+                    ties = keep - taken;
+                    break;
+                }
+                taken += level_records[c];
+            }
+        }
+    }
+    uint32_t cutoff = ties > 0 ? std::numeric_limits<uint32_t>::max() : 0;
+    if (ties > 0)
+    {
+        std::vector<uint32_t> order;
+        for (auto rec = hash_table.GetTable(); rec < end; ++rec)
+        {
+            if (rec->ptr && rec->count == threshold)
+                order.push_back(TieOrder(rec->hash));
+        }
+        if (ties < order.size())
+        {
+            std::nth_element(order.begin(), order.begin() + (ties - 1), order.end());
+            cutoff = order[ties - 1];
+            // the ones equal to the cutoff are taken in slot order
+            ties -= std::count_if(order.begin(), order.begin() + (ties - 1),
+                [&](uint32_t o) { return o < cutoff; });
+        }
+    }
+    const size_t kept = hash_table.Partition([&](const Record& rec)
+    {
+        if (rec.count > threshold)
+            return true;
+        if (rec.count == threshold)
+        {
+            const uint32_t order = TieOrder(rec.hash);
+            if (order < cutoff)
+                return true;
+            if (order == cutoff && ties > 0)
+            {
+                --ties;
+                return true;
+            }
+        }
+        return false;
+    });
+    if (sort)
+        hash_table.SortLexicographic(kept);
+    return kept;
 }
 
-//! put data ('remain' number of records) into memory-buffer
+//! the slabs of the arena should be small compared to the buffer, and never larger than it
+KeyArena make_arena(size_t buffer_size, double max_garbage)
+{
+    return KeyArena(std::min<size_t>(std::min<size_t>(std::max<size_t>(buffer_size / 64, 1 << 12), 1 << 26), buffer_size), max_garbage);
+}
+
+//! what is left of the buffer for the keys, after the overhead of the arena
+size_t key_budget(size_t buffer_size, const KeyArena& arena)
+{
+    return buffer_size - std::min(buffer_size, arena.GetOverhead());
+}
+
+//! what is left of the buffer for a SpillCopy, after the kept keys and the overhead of the arena
+template<typename Table>
+size_t copy_room(size_t buffer_size, const Table& table, size_t kept, const KeyArena& arena)
+{
+    size_t used = arena.GetOverhead();
+    const auto end = table.GetTable() + std::min(kept, table.GetSize());
+    for (auto rec = table.GetTable(); rec < end; ++rec)
+        used += rec->size;
+    return buffer_size - std::min(buffer_size, used);
+}
+
+/** the spilled records with a copy of their keys, for the runs written in the background
+ *
+ * The table is compacted and the next buffer is read while the run is
+ * written, so the spilled records cannot point into the input buffer or
+ * the arena. The copy is held next to the kept keys while the next buffer
+ * is aggregated, so it is made only if it fits into the room the kept keys
+ * leave in the buffer (see copy_room), otherwise that spill is written in
+ * the foreground. The copy is reused by the next spill, eprocess_blocks
+ * waits for the run before that.
+ */
 template<bool binary>
-void reorder_data(HashTable<binary>& hash_table, std::vector<char>& memory, size_t buffer_size, size_t remain)
+class SpillCopy
 {
-    std::vector<char> temp(buffer_size);
-    char* place = temp.data();
-    size_t done = 0;
-    const auto end = hash_table.GetTable() + hash_table.GetAllocatedSize();
-    for (auto rec = hash_table.GetTable(); done < remain && rec < end; ++rec)
+public:
+    typedef RecordView<binary> Record;
+    typedef std::pair<const Record*, const Record*> Range;
+
+    SpillCopy() : copied(false) {}
+
+    //! copies the records and their keys if they fit into room, otherwise returns them as they are
+    Range Assign(const Record* begin, const Record* end, size_t room)
     {
-        if (rec->ptr)
+        if (GetBytes(begin, end) > room)
         {
-            memcpy(place, rec->ptr, rec->size);
-            rec->ptr = place;
-            place += rec->size;
-            ++done;
+            Release();
+            return Range(begin, end);
         }
+        records.assign(begin, end);
+        return Own(room);
     }
-    std::swap(temp, memory);
+    //! copies the keys of the records, if the records and their keys fit into room
+    Range Own(size_t room)
+    {
+        size_t bytes = 0;
+        for (const auto& rec : records)
+            bytes += rec.size;
+        if (keys.capacity() > bytes)
+            std::vector<char>().swap(keys);
+        if (records.capacity() * sizeof(Record) + bytes > room)
+            records.shrink_to_fit();
+        copied = records.capacity() * sizeof(Record) + bytes <= room;
+        if (copied)
+        {
+            keys.resize(bytes);
+            char* key = keys.data();
+            for (auto& rec : records)
+            {
+                memcpy(key, rec.ptr, rec.size);
+                rec.ptr = key;
+                key += rec.size;
+            }
+        }
+        return Range(records.data(), records.data() + records.size());
+    }
+    //! true if the last spill was copied, and it can be written in the background
+    bool Copied()const { return copied; }
+    //! the bytes held by the copy, until the next spill
+    size_t GetBytes()const
+    {
+        return copied ? records.capacity() * sizeof(Record) + keys.capacity() : 0;
+    }
+
+    std::vector<Record> records;
+private:
+    static size_t GetBytes(const Record* begin, const Record* end)
+    {
+        size_t bytes = (end - begin) * sizeof(Record);
+        for (auto rec = begin; rec < end; ++rec)
+            bytes += rec->size;
+        return bytes;
+    }
+    void Release()
+    {
+        copied = false;
+        std::vector<Record>().swap(records);
+        std::vector<char>().swap(keys);
+    }
+
+    std::vector<char> keys;
+    bool copied;
+};
+
+//! measures the phases of the spills: planning, writing, compaction and rehash
+struct SpillTimer
+{
+    typedef std::chrono::steady_clock Clock;
+
+    size_t spills;
+    double total, plan, write, compact, rehash; //!< seconds
+
+    SpillTimer() : spills(0), total(0), plan(0), write(0), compact(0), rehash(0) {}
+    //! the dumper is called
+    void Start() { times[0] = Clock::now(); }
+    //! the records to dump are selected and sorted
+    void Planned() { times[1] = Clock::now(); }
+    //! the dump callback is called
+    void Written() { times[2] = Clock::now(); }
+    void StartRehash() { times[3] = Clock::now(); }
+    void Stop(bool logging)
+    {
+        times[4] = Clock::now();
+        double phases[4];
+        for (int i = 0; i < 4; ++i)
+            phases[i] = std::chrono::duration<double>(times[i + 1] - times[i]).count();
+        const double spill_time = phases[0] + phases[1] + phases[2] + phases[3];
+        ++spills;
+        total += spill_time;
+        plan += phases[0];
+        write += phases[1];
+        compact += phases[2];
+        rehash += phases[3];
+        if (logging)
+            Log("Spill", spill_time, phases[0], phases[1], phases[2], phases[3]);
+    }
+    void Log(const char* what, double spill_time, double plan_time, double write_time, double compact_time, double rehash_time)const
+    {
+        fprintf(stderr, "%s: %.3f s, plan: %.3f s, write: %.3f s, compaction: %.3f s, rehash: %.3f s (%.1f%%)\n",
+            what, spill_time, plan_time, write_time, compact_time, rehash_time,
+            100.0 * rehash_time / std::max(spill_time, 1e-9));
+    }
+private:
+    Clock::time_point times[5];
+};
+
+void log_stats(const Args& args, const HashStats& stats, const SpillTimer& timer, const KeyArena::Stats& arena)
+{
+    fprintf(stderr, "Hash table (%s): %zu inserts, %.3f probes/insert, %.3f compares/insert\n",
+        args.table.c_str(), stats.lookups,
+        stats.probes / std::max<double>(1, stats.lookups),
+        stats.compares / std::max<double>(1, stats.lookups));
+    fprintf(stderr, "%zu ", timer.spills);
+    timer.Log("spills", timer.total, timer.plan, timer.write, timer.compact, timer.rehash);
+    fprintf(stderr, "Key arena: %zu bytes collected, %zu bytes moved, %zu slabs released\n",
+        arena.collected, arena.moved, arena.released);
+}
+
+//! splits [begin, end) into n slices, each but the last one ends with a complete record
+template<bool binary>
+std::vector<char*> split_buffer(char* begin, char* end, size_t n)
+{
+    std::vector<char*> bounds(n + 1, end);
+    bounds[0] = begin;
+    for (size_t i = 1; i < n; ++i)
+    {
+        char* pos = begin + (end - begin) / n * i;
+        if (binary)
+            pos = begin + (pos - begin) / DataView<true>::size * DataView<true>::size;
+        else if ((pos = (char*)Tokenizer::FindSeparator(pos, end)) < end)
+            ++pos;
+        bounds[i] = std::max(bounds[i - 1], pos);
+    }
+    return bounds;
+}
+
+//! every partition has its own hash table, owned by one thread
+template<typename Table>
+std::pair<std::vector<std::string>, size_t>
+collect_partitioned(const Args& args, size_t& total_dumped, HashStats& stats, SpillTimer& timer, KeyArena::Stats& arena_stats)
+{
+    static constexpr bool binary = Table::value_type::binary;
+    typedef std::pair<DataView<binary>, size_t> Routed; // key and its hash
+
+    const size_t n = args.threads;
+    std::vector<Table> tables;
+    tables.reserve(n);
+    for (size_t p = 0; p < n; ++p)
+        tables.emplace_back(8, args.rehash_constant, args.expand_constant);
+
+    // routes[w][p] are the keys found by worker w, belonging to partition p
+    std::vector<std::vector<std::vector<Routed>>> routes(n, std::vector<std::vector<Routed>>(n));
+    std::vector<char*> states(n);
+    std::vector<KeyArena> arenas;
+    arenas.reserve(n);
+    for (size_t p = 0; p < n; ++p)
+        arenas.push_back(make_arena(args.buffer_size / n, args.max_garbage));
+    std::vector<std::pair<size_t, size_t>> remain(n);
+    std::vector<size_t> used(n); // bytes of keys in the partitions
+    std::vector<size_t> room(n); // what the kept keys leave of the buffer of the partitions
+    SpillCopy<binary> spill;
+
+    auto result = eprocess_blocks<RecordView<binary>>(
+        args.buffer_size, args.width, args.prefix, args.logging, args.async, args.compress,
+        [&](char*& begin, char* end)
+        {
+            const auto bounds = split_buffer<binary>(begin, end, n);
+            // tokenize and route
+            ParallelFor(n, [&](size_t w)
+            {
+                DataView<binary> data;
+                char* state = bounds[w];
+                for (auto& route : routes[w])
+                    route.clear();
+                while (data.ReadFrom(state, bounds[w + 1]))
+                {
+                    const size_t hash = KeyHash::hash(data.ptr, data.size);
+                    routes[w][HashPartition(hash, n)].emplace_back(data, hash);
+                }
+                states[w] = state;
+            });
+            // insert into the own partition
+            ParallelFor(n, [&](size_t p)
+            {
+                auto& table = tables[p];
+                for (const auto& route : routes)
+                    for (const auto& routed : route[p])
+                    {
+                        table.insert(routed.first, routed.second);
+                        if (table.GetSize() > args.rehash_constant*table.GetAllocatedSize())
+                            table.rehash();
+                    }
+            });
+            // the slice reaching the end holds the unprocessed bytes
+            size_t w = 0;
+            while (bounds[w + 1] < end)
+                ++w;
+            begin = states[w];
+        },
+        [&](size_t buffer_size)
+        {
+            timer.Start();
+            // the copy of the last spill was held next to the tables
+            const size_t held = spill.GetBytes();
+            ParallelFor(n, [&](size_t p)
+            {
+                auto& table = tables[p];
+                const size_t budget = key_budget(buffer_size / n, arenas[p]);
+                remain[p] = sum_up_lengths(table, budget);
+                used[p] = remain[p].second + arenas[p].GetOverhead();
+                if (remain[p].second > budget)
+                    remain[p].first = plan_spill(table, budget, args.keep_factor);
+                if (args.background)
+                    room[p] = copy_room(buffer_size / n, table, remain[p].first, arenas[p]);
+            });
+            fprintf(stderr,
+                buffer_size > 0 ? ", Buffer: %5.1f%%" : "Buffer: %5.1f%%",
+                (100.0*(std::accumulate(used.begin(), used.end(), (size_t)0) + held)) / args.buffer_size);
+            // partitions have disjoint keys, the run is the merge of the sorted parts
+            std::vector<std::pair<const RecordView<binary>*, const RecordView<binary>*>> parts;
+            for (size_t p = 0; p < n; ++p)
+                parts.emplace_back(tables[p].GetTable() + remain[p].first, tables[p].GetTable() + tables[p].GetSize());
+            spill.records.clear();
+            MergeRanges(parts, spill.records);
+            timer.Planned();
+            if (args.background && buffer_size > 0)
+                return spill.Own(std::accumulate(room.begin(), room.end(), (size_t)0));
+            return std::make_pair((const RecordView<binary>*)spill.records.data(), (const RecordView<binary>*)spill.records.data() + spill.records.size());
+        },
+        [&](size_t dumped)
+        {
+            timer.Written();
+            total_dumped += dumped;
+            ParallelFor(n, [&](size_t p)
+            {
+                auto& table = tables[p];
+                // in binary mode remain.first can be larger than the table
+                const size_t to_clear = table.GetSize() - std::min(remain[p].first, table.GetSize());
+                std::fill_n(table.GetTable() + remain[p].first, to_clear, RecordView<binary>());
+                table.actual_size -= to_clear;
+                arenas[p].Collect(table.GetTable(), table.GetTable() + table.GetAllocatedSize());
+            });
+            timer.StartRehash();
+            ParallelFor(n, [&](size_t p) { tables[p].rehash(); });
+            if (dumped > 0)
+                timer.Stop(args.logging);
+        },
+        [&]() { return spill.Copied(); });
+    for (const auto& table : tables)
+    {
+        stats.lookups += table.GetStats().lookups;
+        stats.probes += table.GetStats().probes;
+        stats.compares += table.GetStats().compares;
+    }
+    for (const auto& arena : arenas)
+    {
+        arena_stats.collected += arena.GetStats().collected;
+        arena_stats.moved += arena.GetStats().moved;
+        arena_stats.released += arena.GetStats().released;
+    }
+    return result;
 }
 
+//! the partition files of the grace mode, in the compact run format
+class PartitionFiles
+{
+public:
+    PartitionFiles(const std::vector<std::string>& names, bool binary, bool compress)
+        : names(names), binary(binary), compress(compress) {}
+    bool Open()
+    {
+        for (const auto& name : names)
+        {
+            FILE* f = fopen(name.c_str(), "wb");
+            if (f == NULL)
+            {
+                std::cerr << "Unable to write \"" << name << "\"!" << std::endl;
+                Close();
+                return false;
+            }
+            files.push_back(f);
+            writers.emplace_back(f, binary, compress);
+        }
+        return true;
+    }
+    bool IsOpen()const { return !files.empty(); }
+    bool Write(size_t p, const char* key, size_t size, size_t count)
+    {
+        return writers[p].Write(key, size, count);
+    }
+    bool Close()
+    {
+        bool result = true;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            result = writers[i].Flush() && result;
+            fclose(files[i]);
+        }
+        files.clear();
+        writers.clear();
+        return result;
+    }
+private:
+    const std::vector<std::string> names;
+    const bool binary, compress;
+    std::vector<FILE*> files;
+    std::vector<RunWriter> writers;
+};
+
+/** name of the p-th partition file of the grace mode
+ *
+ * The top level ones are "<prefix>p001.tmp" and so on, the parts of
+ * "<prefix>p001.tmp" are "<prefix>p001_001.tmp" and so on.
+ */
+std::string partition_name(const Args& args, const std::string& parent, size_t p)
+{
+    const std::string base = parent.empty() ? std::string(args.prefix) + "p" : parent.substr(0, parent.size() - 4) + "_";
+    return GetFilename(p + 1, args.width, base.c_str());
+}
+
+//! every level of the grace mode splits by a different hash
+inline size_t grace_partition(size_t hash, size_t n, size_t level)
+{
+    return HashPartition(level == 0 ? hash : (size_t)((uint64_t)hash * (0x9E3779B97F4A7C15ull + 2 * level)), n);
+}
+
+//! the stored key size, without the terminating '\0' in text mode
 template<bool binary>
-bool MergeFiles(const std::vector<std::string>& filenames, bool logging, size_t total, bool do_delete)
+size_t stored_size(const RecordView<binary>& rec)
+{
+    return binary ? rec.size : rec.size - 1;
+}
+
+inline void set_size(DataView<false>& data, size_t size) { data.size = size; }
+inline void set_size(DataView<true>&, size_t) {}
+
+//! a partition is split at most this many times, heavily skewed ones are aggregated anyway
+static const size_t grace_max_level = 3;
+
+/** aggregates a partition file of the grace mode into a sorted run
+ *
+ * The file is read into memory and its records are added up in a hash
+ * table. If the file is larger than budget, it is split into parts first
+ * and those are aggregated one by one.
+ * The names of the sorted runs are appended to runs, their number of
+ * records is added to total.
+ */
+template<typename Table>
+bool aggregate_partition(const Args& args, const std::string& filename, size_t budget, size_t level,
+    std::vector<std::string>& runs, size_t& total, std::atomic<size_t>& splits)
+{
+    static constexpr bool binary = Table::value_type::binary;
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (f == NULL)
+    {
+        std::cerr << "Unable to open \"" << filename << "\"!" << std::endl;
+        return false;
+    }
+    // the size in memory, compressed partitions are larger there
+    size_t size, records;
+    if (!ScanFrames(filename, size, records))
+        size = GetFileSize(filename);
+    RunReader reader(f, binary ? DataView<true>::size : 0);
+    reader.ReadMagic();
+
+    if (size > budget && level < grace_max_level)
+    {
+        std::vector<std::string> parts(args.grace);
+        for (size_t p = 0; p < parts.size(); ++p)
+            parts[p] = partition_name(args, filename, p);
+        PartitionFiles files(parts, binary, args.compress);
+        bool success = files.Open();
+        const char* key;
+        size_t key_size;
+        uint64_t count;
+        while (success && reader.Next(key, key_size, count))
+            success = files.Write(grace_partition(KeyHash::hash(key, key_size), parts.size(), level + 1), key, key_size, count);
+        success = files.Close() && success;
+        fclose(f);
+        if (args.do_delete)
+            remove(filename.c_str());
+        ++splits;
+        for (const auto& part : parts)
+            success = success && aggregate_partition<Table>(args, part, budget, level + 1, runs, total, splits);
+        return success;
+    }
+
+    std::vector<char> data(size > sizeof(run_magic) ? size - sizeof(run_magic) : 0);
+    const bool success = reader.Read(data.data(), data.size()) == data.size();
+    fclose(f);
+    if (!success)
+    {
+        std::cerr << "Unable to read \"" << filename << "\"!" << std::endl;
+        return false;
+    }
+    if (args.do_delete)
+        remove(filename.c_str());
+
+    Table table(8, args.rehash_constant, args.expand_constant);
+    const char* p = data.data();
+    const char* const end = data.data() + data.size();
+    uint64_t count;
+    while (p < end)
+    {
+        const char* key_end;
+        if (binary)
+            key_end = (size_t)(end - p) >= DataView<true>::size ? p + DataView<true>::size : nullptr;
+        else
+            key_end = (const char*)memchr(p, '\0', end - p);
+        if (key_end == nullptr)
+        {
+            std::cerr << "Unable to read \"" << filename << "\"!" << std::endl;
+            return false;
+        }
+        // text keys are followed by their terminating '\0' in the runs
+        DataView<binary> view;
+        view.ptr = p;
+        set_size(view, binary ? key_end - p : key_end - p + 1);
+        p += view.size;
+        if (!GetVarint(p, end, count))
+        {
+            std::cerr << "Unable to read \"" << filename << "\"!" << std::endl;
+            return false;
+        }
+        table.insert(view, KeyHash::hash(view.ptr, view.size), (size_t)count);
+        if (table.GetSize() > args.rehash_constant*table.GetAllocatedSize())
+            table.rehash();
+    }
+    if (table.GetSize() == 0)
+        return true;
+
+    table.Partition([](const typename Table::value_type&) { return false; });
+    table.SortLexicographic();
+    const std::string run = filename.substr(0, filename.size() - 4) + "s.tmp";
+    if (DumpRun(table.GetTable(), table.GetTable() + table.GetSize(), run, args.compress) < table.GetSize())
+    {
+        std::cerr << "Unable to write \"" << run << "\"!" << std::endl;
+        return false;
+    }
+    runs.push_back(run);
+    total += table.GetSize();
+    return true;
+}
+
+/** grace hash aggregation: spills into hash partitions instead of sorted runs
+ *
+ * The records, which do not fit into the memory, are appended to
+ * args.grace partition files by the hash of their key. At the end the
+ * partitions are aggregated independently, on args.threads threads, and the
+ * resulting sorted runs have disjoint keys, so their merge is cheap.
+ */
+template<typename Table>
+std::pair<std::vector<std::string>, size_t>
+collect_grace(const Args& args, size_t& total_dumped, HashStats& stats, SpillTimer& timer, KeyArena::Stats& arena_stats)
+{
+    static constexpr bool binary = Table::value_type::binary;
+    Table hash_table(8, args.rehash_constant, args.expand_constant);
+    KeyArena arena = make_arena(args.buffer_size, args.max_garbage);
+
+    std::vector<std::string> partitions(args.grace);
+    for (size_t p = 0; p < partitions.size(); ++p)
+        partitions[p] = partition_name(args, "", p);
+    PartitionFiles files(partitions, binary, args.compress);
+    bool spilled = false, failed = false;
+    size_t kept = 0;
+
+    auto result = eprocess<DataView<binary>>(
+        args.buffer_size, args.width, args.prefix, args.logging, args.async, args.compress,
+        [&](const DataView<binary>& data)
+        {
+            hash_table.insert(data);
+            if (hash_table.GetSize() > args.rehash_constant*hash_table.GetAllocatedSize())
+                hash_table.rehash();
+        },
+        [&](size_t buffer_size)
+        {
+            timer.Start();
+            const size_t budget = key_budget(buffer_size, arena);
+            const auto remain = sum_up_lengths(hash_table, budget);
+            fprintf(stderr,
+                buffer_size > 0 ? ", Buffer: %5.1f%%" : "Buffer: %5.1f%%",
+                (100.0*(remain.second + arena.GetOverhead())) / args.buffer_size);
+            // at the end, without any spills, everything goes to the output as usual
+            const bool in_memory = buffer_size == 0 && !spilled;
+            kept = hash_table.GetSize();
+            if (remain.second > budget)
+                kept = plan_spill(hash_table, budget, args.keep_factor, in_memory);
+            timer.Planned();
+            const auto begin = hash_table.GetTable() + kept, end = hash_table.GetTable() + hash_table.GetSize();
+            if (in_memory)
+                return std::make_pair(begin, end);
+
+            if (begin < end && !files.IsOpen())
+                failed = !files.Open() || failed;
+            for (auto rec = begin; !failed && rec < end; ++rec)
+                failed = !files.Write(HashPartition(rec->hash, partitions.size()), rec->ptr, stored_size(*rec), rec->count);
+            spilled = spilled || begin < end;
+            if (buffer_size == 0 && files.IsOpen())
+                failed = !files.Close() || failed;
+            return std::make_pair(end, end);
+        },
+        [&](size_t dumped)
+        {
+            timer.Written();
+            total_dumped += dumped;
+            const bool spill = kept < hash_table.GetSize();
+            std::fill_n(hash_table.GetTable() + kept, hash_table.GetSize() - kept, RecordView<binary>());
+            hash_table.actual_size = kept;
+            arena.Collect(hash_table.GetTable(), hash_table.GetTable() + hash_table.GetAllocatedSize());
+            timer.StartRehash();
+            hash_table.rehash();
+            if (spill)
+                timer.Stop(args.logging);
+        }
+        );
+    stats = hash_table.GetStats();
+    arena_stats = arena.GetStats();
+    if (failed)
+    {
+        files.Close();
+        result.second = 0;
+        return result;
+    }
+    if (!spilled)
+        return result;
+
+    // aggregate the partitions in parallel
+    const auto start = std::chrono::steady_clock::now();
+    const size_t workers = std::max<size_t>(1, std::min(args.threads, partitions.size()));
+    std::vector<std::vector<std::string>> runs(partitions.size());
+    std::vector<size_t> totals(partitions.size(), 0);
+    std::atomic<size_t> next(0), splits(0);
+    std::atomic<bool> success(true);
+    ParallelFor(workers, [&](size_t)
+    {
+        for (size_t p; success && (p = next++) < partitions.size();)
+        {
+            if (!aggregate_partition<Table>(args, partitions[p], args.buffer_size / workers, 0, runs[p], totals[p], splits))
+                success = false;
+        }
+    });
+    result.first.clear();
+    for (const auto& r : runs)
+        result.first.insert(result.first.end(), r.begin(), r.end());
+    total_dumped = std::accumulate(totals.begin(), totals.end(), (size_t)0);
+    result.second = success ? total_dumped : 0;
+    if (args.logging)
+    {
+        fprintf(stderr, "Grace: %zu partitions aggregated on %zu threads, %zu splits, %.3f s\n",
+            partitions.size(), workers, splits.load(),
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return result;
+}
+
+/** merges the runs, the counts of equal keys are added up
+ *
+ * write is called with every distinct key, in order.
+ * The progress is shown only if progress is set (the final merge),
+ * it is updated on the way only if logging is set too.
+ * @return the number of distinct keys
+ */
+template<bool binary, typename Write>
+size_t merge_runs(const std::vector<RunFile>& runs, bool progress, bool logging, size_t total, Write write)
 {
     std::vector<FileReader<Packet<RecordView<binary>>>> files;
-    for (const auto& filename : filenames)
+    files.reserve(runs.size());
+    const size_t block_size = ReadBlockSize(runs.size());
+    for (const auto& run : runs)
     {
-        files.emplace_back(filename, do_delete);
+        files.emplace_back(run.name, run.do_delete, block_size);
         if (files.back().f == NULL)
         {
-            std::cerr << "Unable to open \"" << filename << "\"!" << std::endl;
+            std::cerr << "Unable to open \"" << run.name << "\"!" << std::endl;
             files.pop_back();
         }
     }
-    MergeSort<Packet<RecordView<binary>>> sorter(files.data(), files.data() + files.size());
+    // the text runs are merged in byte order, using their common prefixes
+    typename std::conditional<binary, MergeSort<Packet<RecordView<binary>>>, PrefixMerge<Packet<RecordView<binary>>>>::type
+        sorter(files.data(), files.data() + files.size());
     Packet<RecordView<binary>> previous;
+    size_t written = 0;
     if (sorter.next(previous))
     {
+        // the records point into the read blocks, the one being added up is kept
+        previous.Own();
         size_t processed = 0;
         Packet<RecordView<binary>> next;
-        std::string format_str = total > 0 ? "\rMerging: %5.1f%% " : "\rMerging: %.0f ";
-        if (!binary)
-            format_str += "\"% .30s\"     ";
-        ProgressIndicator(processed, &processed,
-            total > 0 ? (total / 100.0) : 1.0,
-            format_str.c_str(), logging,
-            [&]() {
+        const auto merge = [&]() {
             while (sorter.next(next))
             {
                 ++processed;
@@ -122,21 +852,89 @@ bool MergeFiles(const std::vector<std::string>& filenames, bool logging, size_t
                     previous.view.count += next.view.count;
                 else
                 {
-                    previous.view.DumpTo(stdout);
+                    write(previous.view);
+                    ++written;
                     previous = std::move(next);
+                    previous.Own();
                 }
             }
             ++processed;
-            previous.view.DumpTo(stdout);
-        }, &previous.view.ptr);
+            write(previous.view);
+            ++written;
+        };
+        if (progress)
+        {
+            std::string format_str = total > 0 ? "\rMerging: %5.1f%% " : "\rMerging: %.0f ";
+            if (!binary)
+                format_str += "\"% .30s\"     ";
+            ProgressIndicator(processed, &processed,
+                total > 0 ? (total / 100.0) : 1.0,
+                format_str.c_str(), logging, merge, &previous.view.ptr);
+        }
+        else
+            merge();
     }
+    return written;
+}
+
+//! merges the runs into a new run, in the format of DumpRun
+template<bool binary>
+bool merge_into_run(const std::vector<RunFile>& runs, const std::string& output, bool compress)
+{
+    FILE* f = fopen(output.c_str(), "wb");
+    if (f == NULL)
+        return false;
+    bool success = true;
+    if (binary)
+    {
+        BlockWriter writer(f, compress);
+        merge_runs<binary>(runs, false, false, 0, [&](const RecordView<binary>& rec)
+        {
+            success = success && rec.DumpTo(writer);
+            writer.EndRecord();
+        });
+        success = writer.Flush() && success;
+    }
+    else
+    {
+        RunWriter writer(f, false, compress, true);
+        merge_runs<binary>(runs, false, false, 0, [&](const RecordView<binary>& rec)
+        {
+            success = success && writer.Write(rec.ptr, rec.size - 1, rec.count);
+        });
+        success = writer.Flush() && success;
+    }
+    return fclose(f) == 0 && success;
+}
+
+template<bool binary>
+bool MergeFiles(const std::vector<std::string>& filenames, const Args& args, size_t total)
+{
+    // intermediate passes add up the counts too, the final one gets fewer records
+    const auto runs = CascadeMerge(MakeRunFiles(filenames, args.do_delete),
+        args.fan_in > 0 ? args.fan_in : DefaultFanIn(args.buffer_size),
+        args.width, args.prefix, args.logging,
+        [&](const std::vector<RunFile>& inputs, const std::string& output)
+        {
+            return merge_into_run<binary>(inputs, output, args.compress);
+        });
+    if (runs.empty() && !filenames.empty())
+        return false;
+    BlockWriter output(stdout, false, output_block_size, args.async);
+    merge_runs<binary>(runs, true, args.logging, total > 0 ? total : CompressedRecords(filenames), [&](const RecordView<binary>& rec) { rec.DumpTo(output); });
     std::cerr << std::endl;
+    if (!output.Flush())
+    {
+        std::cerr << "Unable to write the output!" << std::endl;
+        return false;
+    }
     return true;
 }
 
-template<bool binary>
+template<typename Table>
 int ecollect(const Args& args)
 {
+    static constexpr bool binary = Table::value_type::binary;
     SetBinary(args.binary_size);
     SetSeparator(args.separators.c_str());
 
@@ -149,17 +947,42 @@ int ecollect(const Args& args)
             result.first.emplace_back(*filename);
         }
     }
+    else if (args.grace > 0)
+    {   // collect from stdin, spill into hash partitions
+        HashStats stats;
+        SpillTimer timer;
+        KeyArena::Stats arena_stats;
+        result = collect_grace<Table>(args, total_dumped, stats, timer, arena_stats);
+        if (result.second == 0)
+            return 1;
+        if (args.logging)
+            log_stats(args, stats, timer, arena_stats);
+    }
+    else if (args.threads > 1)
+    {   // collect from stdin, on multiple threads
+        HashStats stats;
+        SpillTimer timer;
+        KeyArena::Stats arena_stats;
+        result = collect_partitioned<Table>(args, total_dumped, stats, timer, arena_stats);
+        if (result.second == 0)
+            return 1;
+        if (args.logging)
+            log_stats(args, stats, timer, arena_stats);
+    }
     else
     {   // collect from stdin
-        HashTable<binary> hash_table(8, args.rehash_constant, args.expand_constant);
+        Table hash_table(8, args.rehash_constant, args.expand_constant);
         
-        std::vector<char> in_memory;
+        // the keys kept in memory, after their input buffer is overwritten
+        KeyArena arena = make_arena(args.buffer_size, args.max_garbage);
         // first index of first element to dump
         // second total bytes in buffer
         std::pair<size_t, size_t> remain;
+        SpillTimer timer;
+        SpillCopy<binary> spill;
 
         result = eprocess<DataView<binary>>(
-            args.buffer_size, args.width, args.prefix, args.logging, args.async,
+            args.buffer_size, args.width, args.prefix, args.logging, args.async, args.compress,
             [&](const DataView<binary>& data)
             {
                 hash_table.insert(data);
@@ -168,41 +991,103 @@ int ecollect(const Args& args)
             },
             [&](size_t buffer_size)
             {
-                remain = sum_up_lengths<binary, false>(hash_table, buffer_size);
+                timer.Start();
+                // the copy of the last spill was held next to the table
+                const size_t held = spill.GetBytes();
+                const size_t budget = key_budget(buffer_size, arena);
+                remain = sum_up_lengths(hash_table, budget);
                 fprintf(stderr,
                     buffer_size > 0 ? ", Buffer: %5.1f%%" : "Buffer: %5.1f%%",
-                    (100.0*remain.second) / args.buffer_size);
-                if (remain.second > buffer_size)
+                    (100.0*(remain.second + arena.GetOverhead() + held)) / args.buffer_size);
+                if (remain.second > budget)
                 {
                     // keep as much of the frequent ones as possible
-                    hash_table.SortFreqDescent();
-                    remain = sum_up_lengths<binary, true>(hash_table, buffer_size);
-                    remain.first = (size_t)std::floor(remain.first * args.keep_factor);
-                    hash_table.SortLexicographic(remain.first);
+                    remain.first = plan_spill(hash_table, budget, args.keep_factor);
                 }
-                return std::make_pair(hash_table.GetTable() + remain.first, hash_table.GetTable() + hash_table.GetSize());
+                timer.Planned();
+                const auto begin = hash_table.GetTable() + remain.first, end = hash_table.GetTable() + hash_table.GetSize();
+                if (args.background && buffer_size > 0 && begin < end)
+                    return spill.Assign(begin, end, copy_room(buffer_size, hash_table, remain.first, arena));
+                return std::make_pair((const RecordView<binary>*)begin, (const RecordView<binary>*)end);
             },
             [&](size_t dumped)
             {
+                timer.Written();
                 total_dumped += dumped;
                 // clear dumped
                 std::fill_n(hash_table.GetTable() + remain.first, dumped, RecordView<binary>());
                 hash_table.actual_size -= dumped;
-                // move remaining data in-memory
-                reorder_data<binary>(hash_table, in_memory, args.buffer_size, remain.first);
+                // copy the new keys out of the input buffer, compact the sparse slabs
+                arena.Collect(hash_table.GetTable(), hash_table.GetTable() + hash_table.GetAllocatedSize());
                 // rehash remaining
+                timer.StartRehash();
                 hash_table.rehash();
-            }
-            );
+                if (dumped > 0)
+                    timer.Stop(args.logging);
+            },
+            [&]() { return spill.Copied(); });
         if (result.second == 0)
             return 1;
+        if (args.logging)
+            log_stats(args, hash_table.GetStats(), timer, arena.GetStats());
     }
     if (args.merge)
-        return MergeFiles<binary>(result.first, args.logging, total_dumped, args.do_delete) ? 0 : 1;
+        return MergeFiles<binary>(result.first, args, total_dumped) ? 0 : 1;
     else
         return 0;
 }
 
+//! approximate counts of the frequent keys, in one pass, without temporary files
+template<bool binary>
+int heavy_hitters(const Args& args)
+{
+    SetBinary(args.binary_size);
+    SetSeparator(args.separators.c_str());
+
+    SpaceSaving<binary> counters(args.heavy);
+    std::vector<RecordView<binary>> counts, errors;
+    const auto result = eprocess<DataView<binary>>(
+        args.buffer_size, args.width, args.prefix, args.logging, args.async, args.compress,
+        [&](const DataView<binary>& data)
+        {
+            counters.insert(data);
+        },
+        [&](size_t buffer_size)
+        {   // nothing to spill, the counters are written at the end
+            if (buffer_size == 0)
+                counters.GetRecords(args.min_count, counts, errors);
+            return std::make_pair((const RecordView<binary>*)counts.data(), (const RecordView<binary>*)counts.data() + counts.size());
+        },
+        [](size_t) {}
+        );
+    if (result.second < counts.size())
+        return 1;
+    if (args.bounds && Dump(errors.data(), errors.data() + errors.size(), args.bounds) < errors.size())
+    {
+        std::cerr << "Cannot write error bounds to \"" << args.bounds << "\"!" << std::endl;
+        return 1;
+    }
+    if (args.logging)
+    {
+        fprintf(stderr, "Heavy hitters: %zu keys, %zu of %zu counters used, %zu bytes\n",
+            counters.GetTotal(), counters.GetSize(), counters.GetCapacity(), counters.GetMemory());
+        fprintf(stderr, "Every key more frequent than %zu has a counter, counts are overestimated by at most %zu\n",
+            counters.GetMinCount(), counters.GetMaxError());
+    }
+    return 0;
+}
+
+template<bool binary>
+int ecollect(const Args& args)
+{
+    if (args.heavy > 0)
+        return heavy_hitters<binary>(args);
+    if (args.table == "linear")
+        return ecollect<HashTable<binary>>(args);
+    else
+        return ecollect<GroupHashTable<binary>>(args);
+}
+
 int main(int, const char* argv[])
 {
     Args args;
@@ -243,6 +1128,37 @@ int main(int, const char* argv[])
                 return 1;
             }
         }
+        else if (matches(*argv, { "--grace" }) && *(argv + 1))
+        {
+            args.grace = (size_t)std::max(0ll, atoll(*++argv));
+        }
+        else if (matches(*argv, { "--fan-in" }) && *(argv + 1))
+        {
+            args.fan_in = (size_t)std::max(0ll, atoll(*++argv));
+        }
+        else if (matches(*argv, { "--heavy" }) && *(argv + 1))
+        {
+            args.heavy = (size_t)std::max(0ll, atoll(*++argv));
+        }
+        else if (matches(*argv, { "--min-count" }) && *(argv + 1))
+        {
+            args.min_count = (size_t)std::max(1ll, atoll(*++argv));
+        }
+        else if (matches(*argv, { "--bounds" }) && *(argv + 1))
+        {
+            args.bounds = *++argv;
+        }
+        else if (matches(*argv, { "-g", "--garbage" }) && *(argv + 1))
+        {
+            const auto tmp = atof(*++argv);
+            if (tmp < 1.0 && tmp > 0.0)
+                args.max_garbage = tmp;
+            else
+            {
+                std::cerr << "\"garbage ratio\" should be between 0 and 1 !" << std::endl;
+                return 1;
+            }
+        }
         else if (matches(*argv, { "-b", "--buffer" }) && *(argv + 1))
         {
             args.buffer_size = (size_t)std::max(atoll("1"), atoll(*++argv));
@@ -284,10 +1200,56 @@ int main(int, const char* argv[])
         {
             args.do_delete = false;
         }
+        else if (matches(*argv, { "--compress-temp" }))
+        {
+            args.compress = true;
+        }
+        else if (matches(*argv, { "--io" }) && *(argv + 1))
+        {
+            if (!ParseIoBackend(*++argv, args.io))
+            {
+                std::cerr << "\"io\" should be either \"sync\", \"uring\" or \"threads\" !" << std::endl;
+                return 1;
+            }
+        }
+        else if (matches(*argv, { "--direct" }))
+        {
+            args.direct = true;
+        }
+        else if (matches(*argv, { "--background-spill" }))
+        {
+            args.background = true;
+        }
+        else if (matches(*argv, { "--readers" }) && *(argv + 1))
+        {
+            args.readers = (size_t)std::max(1, atoi(*++argv));
+        }
         else if (matches(*argv, { "-a", "--async" }))
         {
             args.async = true;
         }
+        else if (matches(*argv, { "--table" }) && *(argv + 1))
+        {
+            args.table = *++argv;
+            if (args.table != "group" && args.table != "linear")
+            {
+                std::cerr << "\"table\" should be either \"group\" or \"linear\" !" << std::endl;
+                return 1;
+            }
+        }
+        else if (matches(*argv, { "-t", "--threads" }) && *(argv + 1))
+        {
+            args.threads = (size_t)std::max(1, atoi(*++argv));
+        }
+        else if (matches(*argv, { "--hash" }) && *(argv + 1))
+        {
+            args.hash = *++argv;
+            if (!KeyHash::Set(args.hash))
+            {
+                std::cerr << "\"hash\" should be either \"wyhash\" or \"fnv1a\" !" << std::endl;
+                return 1;
+            }
+        }
         else if (matches(*argv, { "-h", "--help" }))
         {
             std::cout << std::boolalpha;
@@ -305,12 +1267,14 @@ int main(int, const char* argv[])
                 "               |____V||  .  |\n"
                 "                      |____V|\n"
                 "ascii art by ejm\n" << std::endl;
-            std::cout << "USAGE: " << program_name << " [options] < input.file > output.result" << std::endl;
+            std::cout << "USAGE: " << program_name << " [options] [input.files] > output.result" << std::endl;
+            std::cout << "The input files are read as if they were concatenated, stdin (or \"-\") is read if there are none." << std::endl;
             std::cout << "OPTIONS:" << std::endl;
             std::cout << "\t-h --help\tshow this help and exit" << std::endl;
             std::cout << "\t-r --rehash <double>\trehash factor for hash table, default " << args.rehash_constant << std::endl;
             std::cout << "\t-e --expand <double>\texpansion rate for hash table, default " << args.expand_constant << std::endl;
             std::cout << "\t-k --keep <double>\tkeep factor, sets how much to keep in memory in case of dumping into file, default " << args.keep_factor << std::endl;
+            std::cout << "\t-g --garbage <double>\tkeys in memory are compacted only in slabs with more garbage than this ratio, default " << args.max_garbage << std::endl;
             std::cout << "\t-w --width <size_t>\ttemporary filename padding width, default " << args.width << std::endl;
             std::cout << "\t-p --prefix <str>\ttemporary filename prefix, default \"" << args.prefix << "\"" << std::endl;
             std::cout << "\t-s --separator <str>\tseparators in text mode, default \"";
@@ -322,9 +1286,26 @@ int main(int, const char* argv[])
             std::cout << "\t-M --no-merge\tdon't merge temporary files just leave them, default " << !args.merge << std::endl;
             std::cout << "\t-m --merge\tdon't collect from stdin rather merge the files specified after this argument, no more argument is parsed" << std::endl;
             std::cout << "\t-D --no-delete\tdon't delete temporary files after merging, default " << !args.do_delete << std::endl;
-            std::cout << "\t-a --async\tuses an extra buffer for reading asynchronously from stdin, faster but uses more memory, default " << args.async << std::endl;
+            std::cout << "\t--fan-in <size_t>\tmaximum number of files merged at once, more files are merged in several passes, 0 means automatic (from the buffer size and the open file limit), default " << args.fan_in << std::endl;
+            std::cout << "\t-a --async\tuses extra buffers for reading stdin and writing stdout asynchronously, faster but uses more memory (a second input buffer), default " << args.async << std::endl;
+            std::cout << "\t--background-spill\twrites the spills on another thread while the next buffer is read and aggregated, the spilled records and their keys are copied for that, if the copy does not fit into --buffer next to the kept keys, that spill is written in the foreground, default " << args.background << std::endl;
+            std::cout << "\t--compress-temp\tcompresses the temporary files, faster if the disk is slower than the compression, default " << args.compress << std::endl;
+            std::cout << "\t--io <string>\treads and writes the temporary files (and the ones of -m) with several requests in flight: \"uring\" (io_uring, threads if it is not available), \"threads\" or \"sync\" (stdio and mmap), default " << IoBackendName(args.io) << std::endl;
+            std::cout << "\t--direct\tuses O_DIRECT for the temporary files with --io uring or threads, so they do not fill the page cache, default " << args.direct << std::endl;
+            std::cout << "\t--readers <size_t>\tnumber of threads reading the input files, in byte ranges cut at the records, default " << args.readers << std::endl;
+            std::cout << "\t--table <str>\thash table engine: \"group\" (tag bytes probed 16 slots at a time) or \"linear\" (plain linear probing), default \"" << args.table << "\"" << std::endl;
+            std::cout << "\t-t --threads <size_t>\tnumber of threads, keys are partitioned among them by hash, default " << args.threads << std::endl;
+            std::cout << "\t--hash <str>\thash function of the hash table: \"wyhash\" or \"fnv1a\", default \"" << args.hash << "\"" << std::endl;
+            std::cout << "\t--grace <size_t>\tgrace hash aggregation: spills into this many hash partitions instead of sorted runs, then aggregates the partitions on --threads threads, 0 means sorted runs, default " << args.grace << std::endl;
+            std::cout << "\t--heavy <size_t>\tapproximate mode: counts the frequent keys in this many counters (Space-Saving), in one pass without temporary files, 0 means exact counting, default " << args.heavy << std::endl;
+            std::cout << "\t--min-count <size_t>\tin approximate mode, writes only the keys with at least this (estimated) count, default " << args.min_count << std::endl;
+            std::cout << "\t--bounds <str>\tin approximate mode, writes the error bounds of the counts into this file, in the same format as the counts" << std::endl;
             return 0;
         }
+        else if (**argv != '-' || strcmp(*argv, "-") == 0)
+        {
+            args.inputs.emplace_back(*argv);
+        }
         else
         {
             std::cerr << "Unknown argument \"" << *argv << "\"!" << std::endl;
@@ -334,6 +1315,8 @@ int main(int, const char* argv[])
     if (args.separators.find('\n') == std::string::npos)
         args.separators += '\n';
 
+    if (SetAsyncIo(args.io, args.direct) != args.io)
+        std::cerr << "io_uring is not available, using threads" << std::endl;
     if (args.binary_size > 0)
     {
         if (args.buffer_size % args.binary_size != 0)
@@ -347,5 +1330,7 @@ int main(int, const char* argv[])
             return 1;
         }
     }
+    if (!SetInput(args.inputs, args.readers, args.binary_size))
+        return 1;
     return (args.binary_size > 0 ? ecollect<true> : ecollect<false>)(args);
 }
@@ -13,29 +13,36 @@ struct Args
     size_t binary_size;
     size_t buffer_size;
     int width;
+    size_t readers;
 
     const char* prefix;
     const char** filenames;
+    std::vector<std::string> inputs;
 
     const char* separators;
     unsigned int seed;
+    IoBackend io;
 
-    bool logging, merge, do_delete, async;
+    bool logging, merge, do_delete, async, compress, direct;
     Args() :
-        binary_size(0), buffer_size(((size_t)1) << 25), width(3),
+        binary_size(0), buffer_size(((size_t)1) << 25), width(3), readers(1),
         prefix(""), filenames(nullptr), separators("\n\r"),
-        seed(0), logging(false), merge(true), do_delete(true), async(false)
+        seed(0), io(IoBackend::sync), logging(false), merge(true), do_delete(true), async(false), compress(false), direct(false)
     {}
 };
 
 template<bool binary>
-bool ShuffleMergeFiles(const std::vector<std::string> filenames, bool logging, size_t total, unsigned seed, bool do_delete)
+bool ShuffleMergeFiles(const std::vector<std::string> filenames, bool logging, size_t total, unsigned seed, bool do_delete, bool async)
 {
     std::vector<FileReader<Packet<DataView<binary>>>> files;
     Packet<DataView<binary>> data;
+    if (total == 0)
+        total = CompressedRecords(filenames);
+    files.reserve(filenames.size());
+    const size_t block_size = ReadBlockSize(filenames.size());
     for (const auto& filename : filenames)
     {
-        files.emplace_back(filename, do_delete);
+        files.emplace_back(filename, do_delete, block_size);
         if (files.back().f == NULL)
         {
             std::cerr << "Unable to open \"" << filename << "\"!" << std::endl;
@@ -44,6 +51,7 @@ bool ShuffleMergeFiles(const std::vector<std::string> filenames, bool logging, s
     }
     size_t processed = 0;
     MergeShuffle<Packet<DataView<binary>>> shuffler(files.data(), files.data() + files.size(), seed);
+    BlockWriter output(stdout, false, output_block_size, async);
 
     ProgressIndicator(processed, &processed,
         total > 0 ? (total / 100.0) : 1.0,
@@ -52,10 +60,15 @@ bool ShuffleMergeFiles(const std::vector<std::string> filenames, bool logging, s
         while (shuffler.next(data))
         {
             ++processed;
-            data.view.DumpTo(stdout);
+            data.view.DumpTo(output);
         }
     });
     std::cerr << std::endl;
+    if (!output.Flush())
+    {
+        std::cerr << "Unable to write the output!" << std::endl;
+        return false;
+    }
     return true;
 }
 
@@ -80,7 +93,7 @@ int eshuffle(const Args& args)
         std::default_random_engine rng(args.seed);
 
         result = eprocess<DataView<binary>>(
-            args.buffer_size, args.width, args.prefix, args.logging, args.async,
+            args.buffer_size, args.width, args.prefix, args.logging, args.async, args.compress,
             [&](const DataView<binary>& data)
             {
                 table.emplace_back(data);
@@ -97,7 +110,7 @@ int eshuffle(const Args& args)
     }
     if (args.merge)
     {
-        return ShuffleMergeFiles<binary>(result.first, args.logging, result.second, args.seed, args.do_delete) ? 0 : 1;
+        return ShuffleMergeFiles<binary>(result.first, args.logging, result.second, args.seed, args.do_delete, args.async) ? 0 : 1;
     }
     else
         return 0;
@@ -151,6 +164,26 @@ int main(int, const char* argv[])
         {
             args.do_delete = false;
         }
+        else if (matches(*argv, { "--compress-temp" }))
+        {
+            args.compress = true;
+        }
+        else if (matches(*argv, { "--io" }) && *(argv + 1))
+        {
+            if (!ParseIoBackend(*++argv, args.io))
+            {
+                std::cerr << "\"io\" should be either \"sync\", \"uring\" or \"threads\" !" << std::endl;
+                return 1;
+            }
+        }
+        else if (matches(*argv, { "--direct" }))
+        {
+            args.direct = true;
+        }
+        else if (matches(*argv, { "--readers" }) && *(argv + 1))
+        {
+            args.readers = (size_t)std::max(1, atoi(*++argv));
+        }
         else if (matches(*argv, { "-a", "--async" }))
         {
             args.async = true;
@@ -175,7 +208,8 @@ int main(int, const char* argv[])
                 "               |____V||  .  |\n"
                 "                      |____V|\n"
                 "ascii art by ejm\n" << std::endl;
-            std::cout << "USAGE: " << program_name << " [options] < input.file > output.result" << std::endl;
+            std::cout << "USAGE: " << program_name << " [options] [input.files] > output.result" << std::endl;
+            std::cout << "The input files are read as if they were concatenated, stdin (or \"-\") is read if there are none." << std::endl;
             std::cout << "OPTIONS:" << std::endl;
             std::cout << "\t-h --help\tshow this help and exit" << std::endl;
             std::cout << "\t-w --width <size_t>\ttemporary filename padding width, default " << args.width << std::endl;
@@ -189,10 +223,18 @@ int main(int, const char* argv[])
             std::cout << "\t-M --no-merge\tdon't merge temporary files just leave them, default " << !args.merge << std::endl;
             std::cout << "\t-m --merge\tdon't collect from stdin rather merge the files specified after this argument, no more argument is parsed" << std::endl;
             std::cout << "\t-D --no-delete\tdon't delete temporary files after merging, default " << !args.do_delete << std::endl;
-            std::cout << "\t-a --async\tuses an extra buffer for reading asynchronously from stdin, faster but uses more memory, default " << args.async << std::endl;
+            std::cout << "\t-a --async\tuses extra buffers for reading stdin and writing stdout asynchronously, faster but uses more memory, default " << args.async << std::endl;
+            std::cout << "\t--compress-temp\tcompresses the temporary files, faster if the disk is slower than the compression, default " << args.compress << std::endl;
+            std::cout << "\t--io <string>\treads and writes the temporary files (and the ones of -m) with several requests in flight: \"uring\" (io_uring, threads if it is not available), \"threads\" or \"sync\" (stdio and mmap), default " << IoBackendName(args.io) << std::endl;
+            std::cout << "\t--direct\tuses O_DIRECT for the temporary files with --io uring or threads, so they do not fill the page cache, default " << args.direct << std::endl;
+            std::cout << "\t--readers <size_t>\tnumber of threads reading the input files, in byte ranges cut at the records, default " << args.readers << std::endl;
             std::cout << "\t--seed --random <int>\tuse this value as random seed, zero means use time, default " << args.seed << std::endl;
             return 0;
         }
+        else if (**argv != '-' || strcmp(*argv, "-") == 0)
+        {
+            args.inputs.emplace_back(*argv);
+        }
         else
         {
             std::cerr << "Unknown argument \"" << *argv << "\"!" << std::endl;
@@ -204,6 +246,8 @@ int main(int, const char* argv[])
         args.seed = (unsigned int)std::chrono::system_clock::now().time_since_epoch().count();
     }
 
+    if (SetAsyncIo(args.io, args.direct) != args.io)
+        std::cerr << "io_uring is not available, using threads" << std::endl;
     if (args.binary_size > 0)
     {
         if (args.buffer_size % args.binary_size != 0)
@@ -217,5 +261,7 @@ int main(int, const char* argv[])
             return 1;
         }
     }
+    if (!SetInput(args.inputs, args.readers, args.binary_size))
+        return 1;
     return (args.binary_size > 0 ? eshuffle<true> : eshuffle<false>)(args);
 }
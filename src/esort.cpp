@@ -16,59 +16,174 @@ struct Args
     size_t binary_size;
     size_t buffer_size;
     int width;
+    size_t fan_in, readers, threads;
 
     const char* prefix;
     const char** filenames;
+    std::vector<std::string> inputs;
 
     const char* separators;
     const char* format;
     std::vector<int> keys;
+    IoBackend io;
 
-    bool logging, merge, do_delete, async;
+    bool logging, merge, do_delete, async, compress, direct;
     Args() :
-        binary_size(0), buffer_size(((size_t)1) << 25), width(3),
+        binary_size(0), buffer_size(((size_t)1) << 25), width(3), fan_in(0), readers(1), threads(1),
         prefix(""), filenames(nullptr), separators("\n\r"),
-        format("%s"), keys(1, 1),
-        logging(false), merge(true), do_delete(true), async(false)
+        format("%s"), keys(1, 1), io(IoBackend::sync),
+        logging(false), merge(true), do_delete(true), async(false), compress(false), direct(false)
     {}
 };
 
-template<bool binary>
-bool MergeFiles(const std::vector<std::string>& filenames, bool logging, size_t total, bool do_delete)
+/** merges the runs, write is called with every record, in order
+ *
+ * The progress is shown only if progress is set (the final merge),
+ * it is updated on the way only if logging is set too.
+ */
+template<bool binary, typename Write>
+void merge_runs(const std::vector<RunFile>& runs, bool progress, bool logging, size_t total, Write write)
 {
     std::vector<FileReader<Packet<TupleView<binary>>>> files;
     Packet<TupleView<binary>> data;
     size_t processed = 0;
 
-    for (const auto& filename : filenames)
+    files.reserve(runs.size());
+    const size_t block_size = ReadBlockSize(runs.size());
+    for (const auto& run : runs)
     {
-        files.emplace_back(filename, do_delete);
+        files.emplace_back(run.name, run.do_delete, block_size);
         if (files.back().f == NULL)
         {
-            std::cerr << "Unable to open \"" << filename << "\"!" << std::endl;
+            std::cerr << "Unable to open \"" << run.name << "\"!" << std::endl;
             files.pop_back();
         }
     }
     
     MergeSort<Packet<TupleView<binary>>> sorter(files.data(), files.data() + files.size());
     
-    std::string format_str = total > 0 ? "\rMerging: %5.1f%% " : "\rMerging: %.0f ";
-    if (!binary)
-        format_str += "\"% .30s\"     ";
-
-    ProgressIndicator(processed, &processed,
-        total > 0 ? (total / 100.0) : 1.0, format_str.c_str(), logging,
-        [&](){
+    const auto merge = [&](){
         while (sorter.next(data))
         {
             ++processed;
-            data.view.DumpTo(stdout);
+            write(data.view);
         }
-        }, &data.view.ptr);
+    };
+    if (progress)
+    {
+        std::string format_str = total > 0 ? "\rMerging: %5.1f%% " : "\rMerging: %.0f ";
+        if (!binary)
+            format_str += "\"% .30s\"     ";
+
+        ProgressIndicator(processed, &processed,
+            total > 0 ? (total / 100.0) : 1.0, format_str.c_str(), logging,
+            merge, &data.view.ptr);
+    }
+    else
+        merge();
+}
+
+//! merges the runs into a new run, in the format of the dumped runs
+template<bool binary>
+bool merge_into_run(const std::vector<RunFile>& runs, const std::string& output, bool compress);
+
+template<>
+bool merge_into_run<true>(const std::vector<RunFile>& runs, const std::string& output, bool compress)
+{
+    FILE* f = fopen(output.c_str(), "wb");
+    if (f == NULL)
+        return false;
+    BlockWriter writer(f, compress);
+    bool success = true;
+    merge_runs<true>(runs, false, false, 0, [&](const TupleView<true>& t)
+    {
+        success = success && t.DumpTo(writer);
+        writer.EndRecord();
+    });
+    success = writer.Flush() && success;
+    return fclose(f) == 0 && success;
+}
+
+template<>
+bool merge_into_run<false>(const std::vector<RunFile>& runs, const std::string& output, bool compress)
+{
+    FILE* f = fopen(output.c_str(), "wb");
+    if (f == NULL)
+        return false;
+    RunWriter writer(f, false, compress, true, false);
+    bool success = true;
+    merge_runs<false>(runs, false, false, 0, [&](const TupleView<false>& t)
+    {
+        success = success && writer.Write(t.ptr, t.size - 1, 1);
+    });
+    success = writer.Flush() && success;
+    return fclose(f) == 0 && success;
+}
+
+template<bool binary>
+bool MergeFiles(const std::vector<std::string>& filenames, const Args& args, size_t total)
+{
+    const auto runs = CascadeMerge(MakeRunFiles(filenames, args.do_delete),
+        args.fan_in > 0 ? args.fan_in : DefaultFanIn(args.buffer_size),
+        args.width, args.prefix, args.logging,
+        [&](const std::vector<RunFile>& inputs, const std::string& output)
+        {
+            return merge_into_run<binary>(inputs, output, args.compress);
+        });
+    if (runs.empty() && !filenames.empty())
+        return false;
+    BlockWriter output(stdout, false, output_block_size, args.async);
+    merge_runs<binary>(runs, true, args.logging, total > 0 ? total : CompressedRecords(filenames), [&](const TupleView<binary>& t) { t.DumpTo(output); });
     std::cerr << std::endl;
+    if (!output.Flush())
+    {
+        std::cerr << "Unable to write the output!" << std::endl;
+        return false;
+    }
     return true;
 }
 
+//! reads the input into sorted runs
+template<bool binary>
+std::pair<std::vector<std::string>, size_t> make_runs(const Args& args);
+
+template<>
+std::pair<std::vector<std::string>, size_t> make_runs<true>(const Args& args)
+{
+    std::vector<TupleView<true>> table;
+    return eprocess<TupleView<true>>(
+        args.buffer_size, args.width, args.prefix, args.logging, args.async, args.compress,
+        [&](const TupleView<true>& data)
+        {
+            table.emplace_back(data);
+        },
+        [&](size_t)
+        {
+            SortRun(table.data(), table.data() + table.size(), args.threads);
+            return std::make_pair(table.data(), table.data() + table.size());
+        },
+        [&](size_t){ table.clear(); }
+        );
+}
+
+template<>
+std::pair<std::vector<std::string>, size_t> make_runs<false>(const Args& args)
+{
+    TupleBatch batch;
+    return eprocess_blocks<DataView<false>>(
+        args.buffer_size, args.width, args.prefix, args.logging, args.async, args.compress,
+        [&](char*& begin, char* end)
+        {
+            batch.Read(begin, end);
+        },
+        [&](size_t)
+        {
+            return batch.Sort(args.threads);
+        },
+        [&](size_t){ batch.Clear(); }
+        );
+}
+
 template<bool binary>
 int esort(const Args& args)
 {
@@ -92,26 +207,12 @@ int esort(const Args& args)
     }
     else
     {   // collect from stdin
-        std::vector<TupleView<binary>> table;
-
-        result = eprocess<TupleView<binary>>(
-            args.buffer_size, args.width, args.prefix, args.logging, args.async,
-            [&](const TupleView<binary>& data)
-            {
-                table.emplace_back(data);
-            },
-            [&](size_t)
-            {
-                std::sort(table.begin(), table.end());
-                return std::make_pair(table.data(), table.data() + table.size());
-            },
-            [&](size_t){ table.clear(); }
-            );
+        result = make_runs<binary>(args);
         if (result.second == 0)
             return 1;
     }
     if (args.merge)
-        return MergeFiles<binary>(result.first, args.logging, total_dumped, args.do_delete) ? 0 : 1;
+        return MergeFiles<binary>(result.first, args, total_dumped) ? 0 : 1;
     else
         return 0;
 }
@@ -164,6 +265,34 @@ int main(int, const char* argv[])
         {
             args.do_delete = false;
         }
+        else if (matches(*argv, { "--fan-in" }) && *(argv + 1))
+        {
+            args.fan_in = (size_t)std::max(0ll, atoll(*++argv));
+        }
+        else if (matches(*argv, { "--compress-temp" }))
+        {
+            args.compress = true;
+        }
+        else if (matches(*argv, { "--io" }) && *(argv + 1))
+        {
+            if (!ParseIoBackend(*++argv, args.io))
+            {
+                std::cerr << "\"io\" should be either \"sync\", \"uring\" or \"threads\" !" << std::endl;
+                return 1;
+            }
+        }
+        else if (matches(*argv, { "--direct" }))
+        {
+            args.direct = true;
+        }
+        else if (matches(*argv, { "--readers" }) && *(argv + 1))
+        {
+            args.readers = (size_t)std::max(1, atoi(*++argv));
+        }
+        else if (matches(*argv, { "-t", "--threads" }) && *(argv + 1))
+        {
+            args.threads = (size_t)std::max(1, atoi(*++argv));
+        }
         else if (matches(*argv, { "-a", "--async" }))
         {
             args.async = true;
@@ -202,7 +331,8 @@ int main(int, const char* argv[])
                 "               |____V||  .  |\n"
                 "                      |____V|\n"
                 "ascii art by ejm\n" << std::endl;
-            std::cout << "USAGE: " << program_name << " [options] < input.file > output.result" << std::endl;
+            std::cout << "USAGE: " << program_name << " [options] [input.files] > output.result" << std::endl;
+            std::cout << "The input files are read as if they were concatenated, stdin (or \"-\") is read if there are none." << std::endl;
             std::cout << "OPTIONS:" << std::endl;
             std::cout << "\t-h --help\tshow this help and exit" << std::endl;
             std::cout << "\t-w --width <size_t>\ttemporary filename padding width, default " << args.width << std::endl;
@@ -216,7 +346,13 @@ int main(int, const char* argv[])
             std::cout << "\t-M --no-merge\tdon't merge temporary files just leave them, default " << !args.merge << std::endl;
             std::cout << "\t-m --merge\tdon't collect from stdin rather merge the files specified after this argument, no more argument is parsed" << std::endl;
             std::cout << "\t-D --no-delete\tdon't delete temporary files after merging, default " << !args.do_delete << std::endl;
-            std::cout << "\t-a --async\tuses an extra buffer for reading asynchronously from stdin, faster but uses more memory, default " << args.async << std::endl;
+            std::cout << "\t--fan-in <size_t>\tmaximum number of files merged at once, more files are merged in several passes, 0 means automatic (from the buffer size and the open file limit), default " << args.fan_in << std::endl;
+            std::cout << "\t-a --async\tuses extra buffers for reading stdin and writing stdout asynchronously, faster but uses more memory, default " << args.async << std::endl;
+            std::cout << "\t--compress-temp\tcompresses the temporary files, faster if the disk is slower than the compression, default " << args.compress << std::endl;
+            std::cout << "\t--io <string>\treads and writes the temporary files (and the ones of -m) with several requests in flight: \"uring\" (io_uring, threads if it is not available), \"threads\" or \"sync\" (stdio and mmap), default " << IoBackendName(args.io) << std::endl;
+            std::cout << "\t--direct\tuses O_DIRECT for the temporary files with --io uring or threads, so they do not fill the page cache, default " << args.direct << std::endl;
+            std::cout << "\t--readers <size_t>\tnumber of threads reading the input files, in byte ranges cut at the records, default " << args.readers << std::endl;
+            std::cout << "\t-t --threads <size_t>\tnumber of threads sorting a run, the output is the same for any number, default " << args.threads << std::endl;
             std::cout << "\t-f --format\tformat of the data, default \"" << args.format << "\""<< std::endl;
             std::cout << "\t-k --keys\tkeys of the fields to determine ordering, default: ";
             for (auto k : args.keys)
@@ -224,6 +360,10 @@ int main(int, const char* argv[])
             std::cout << std::endl;
             return 0;
         }
+        else if (**argv != '-' || strcmp(*argv, "-") == 0)
+        {
+            args.inputs.emplace_back(*argv);
+        }
         else
         {
             std::cerr << "Unknown argument \"" << *argv << "\"!" << std::endl;
@@ -235,6 +375,8 @@ int main(int, const char* argv[])
     //auto i = sscanf("abc123", "%*[^0123456789]%n%zu", &n, &x);
     //return i;
 
+    if (SetAsyncIo(args.io, args.direct) != args.io)
+        std::cerr << "io_uring is not available, using threads" << std::endl;
     if (args.binary_size > 0)
     {
         if (args.buffer_size % args.binary_size != 0)
@@ -248,5 +390,7 @@ int main(int, const char* argv[])
             return 1;
         }
     }
+    if (!SetInput(args.inputs, args.readers, args.binary_size))
+        return 1;
     return (args.binary_size > 0 ? esort<true> : esort<false>)(args);
 }